@@ -4,6 +4,7 @@
 #include <unordered_map>
 #include <mutex>
 #include <string>
+#include <string_view>
 
 #include "Note.h"
 #include "utils/SharedMap.h"
@@ -92,7 +93,7 @@ public:
         return token = std::to_string(std::hash<std::string>{}(seed.str()));
     }
 
-    bool equalToken(const std::string &tokenToTest) const
+    bool equalToken(std::string_view tokenToTest) const
     {
         std::shared_lock lock(tokenMutex);
         return end > std::chrono::system_clock::now() && token == tokenToTest;
@@ -36,15 +36,27 @@ RequestHandler::CallbackType noteIdValidator = Validators::pathParamLength("note
 int main(int argc, char **argv)
 {
     int port = 3001;
-    if (argc == 2)
+    unsigned threads = 1;
+    if (argc >= 2)
         port = std::stoi(argv[1]);
-    else if (argc > 2) 
+    if (argc >= 3)
+        threads = std::stoul(argv[2]);
+    if (argc == 4)
+    {
+        if (std::string(argv[3]) != "io_uring")
+        {
+            std::cerr << "Unknown backend " << argv[3] << std::endl;
+            return 0;
+        }
+        server.setBackend(Poller::Backend::io_uring);
+    }
+    else if (argc > 4) 
     {
         std::cerr << "Too many arguments" << std::endl;
         return 0;
     }
 
-    server.get("/helloworld", [](auto &request, auto &response) {
+    server.get("/helloworld", RequestHandler::runInline, [](auto &request, auto &response) {
         response.setStatus(200).setBody("<h1>Hello</h1>:)");
     });
 
@@ -201,5 +213,5 @@ int main(int argc, char **argv)
     // for testing frontend on development server
     // server.addAccessControllAllowOrigin("*");
 
-    server.listen(port);
+    server.listen(port, threads);
 }
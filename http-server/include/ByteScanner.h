@@ -0,0 +1,130 @@
+#ifndef BYTESCANNER_H
+#define BYTESCANNER_H
+
+#include <cstdint>
+#include <string_view>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HTTP_SERVER_HAS_X86_SIMD
+#endif
+
+// Finds every occurrence of two bytes (the line feeds and colons of a header) in a
+// single pass, a whole vector at a time: each block is compared with both bytes at
+// once and the matches come out as a bit mask, so the bytes in between cost nothing.
+// The kernel is chosen once from CPUID: AVX2 (64 bytes per step) when the CPU has
+// it, otherwise SSE2 (16 bytes), which every x86-64 CPU has. Other architectures
+// compare byte by byte.
+class ByteScanner
+{
+public:
+    enum class Kernel
+    {
+        scalar, sse2, avx2
+    };
+
+    static constexpr size_t npos = std::string_view::npos;
+
+    // calls visit(index) for every byte of data equal to first or second, in order,
+    // until visit returns false
+    template <typename Visitor>
+    static void forEach(std::string_view data, char first, char second, Visitor &&visit)
+    {
+        forEach(data, first, second, visit, kernel());
+    }
+
+    template <typename Visitor>
+    static void forEach(std::string_view data, char first, char second, Visitor &&visit, Kernel kernel)
+    {
+        size_t index = 0;
+#ifdef HTTP_SERVER_HAS_X86_SIMD
+        if (kernel == Kernel::avx2)
+            index = forEachAvx2(data, first, second, visit);
+        else if (kernel == Kernel::sse2)
+            index = forEachSse2(data, 0, first, second, visit);
+        if (index == npos)
+            return;
+#endif
+        // fewer bytes than a block are left
+        for (; index < data.size(); index++)
+            if ((data[index] == first || data[index] == second) && !visit(index))
+                return;
+    }
+
+    static Kernel kernel()
+    {
+        static const Kernel selected = detect();
+        return selected;
+    }
+
+private:
+    static Kernel detect()
+    {
+#ifdef HTTP_SERVER_HAS_X86_SIMD
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2"))
+            return Kernel::avx2;
+        if (__builtin_cpu_supports("sse2"))
+            return Kernel::sse2;
+#endif
+        return Kernel::scalar;
+    }
+
+#ifdef HTTP_SERVER_HAS_X86_SIMD
+    // bit i of matches is set if the byte at offset + i is one of the two
+    template <typename Visitor>
+    static bool visitMatches(size_t offset, uint64_t matches, Visitor &visit)
+    {
+        while (matches)
+        {
+            if (!visit(offset + static_cast<size_t>(__builtin_ctzll(matches))))
+                return false;
+            matches &= matches - 1;
+        }
+        return true;
+    }
+
+    // returns the index of the first byte not scanned, npos if visit stopped the scan
+    template <typename Visitor>
+    __attribute__((target("avx2")))
+    static size_t forEachAvx2(std::string_view data, char first, char second, Visitor &visit)
+    {
+        const char *bytes = data.data();
+        const __m256i firstBytes = _mm256_set1_epi8(first);
+        const __m256i secondBytes = _mm256_set1_epi8(second);
+        size_t i = 0;
+        for (; i + 64 <= data.size(); i += 64)
+        {
+            __m256i low = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(bytes + i));
+            __m256i high = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(bytes + i + 32));
+            __m256i lowMatches = _mm256_or_si256(_mm256_cmpeq_epi8(low, firstBytes), _mm256_cmpeq_epi8(low, secondBytes));
+            __m256i highMatches = _mm256_or_si256(_mm256_cmpeq_epi8(high, firstBytes), _mm256_cmpeq_epi8(high, secondBytes));
+            uint64_t matches = static_cast<uint32_t>(_mm256_movemask_epi8(lowMatches))
+                | static_cast<uint64_t>(static_cast<uint32_t>(_mm256_movemask_epi8(highMatches))) << 32;
+            if (!visitMatches(i, matches, visit))
+                return npos;
+        }
+        return forEachSse2(data, i, first, second, visit);
+    }
+
+    template <typename Visitor>
+    __attribute__((target("sse2")))
+    static size_t forEachSse2(std::string_view data, size_t from, char first, char second, Visitor &visit)
+    {
+        const char *bytes = data.data();
+        const __m128i firstBytes = _mm_set1_epi8(first);
+        const __m128i secondBytes = _mm_set1_epi8(second);
+        size_t i = from;
+        for (; i + 16 <= data.size(); i += 16)
+        {
+            __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i *>(bytes + i));
+            __m128i matches = _mm_or_si128(_mm_cmpeq_epi8(block, firstBytes), _mm_cmpeq_epi8(block, secondBytes));
+            if (!visitMatches(i, static_cast<uint32_t>(_mm_movemask_epi8(matches)), visit))
+                return npos;
+        }
+        return i;
+    }
+#endif
+};
+
+#endif /* BYTESCANNER_H */
@@ -0,0 +1,53 @@
+#ifndef COMPLETIONQUEUE_H
+#define COMPLETIONQUEUE_H
+
+#include <atomic>
+
+// Lock-free multiple producers / single consumer queue of intrusive nodes.
+// Node must have a `Node *next` member accessible to the queue and must stay
+// alive (and must not be pushed again) until the consumer has taken it.
+template <class Node>
+class CompletionQueue
+{
+public:
+    CompletionQueue() = default;
+    CompletionQueue(const CompletionQueue &) = delete;
+    CompletionQueue &operator=(const CompletionQueue &) = delete;
+
+    // may be called from any thread, the node must not be touched afterwards
+    // (by the producer) as the consumer may already have destroyed it
+    // returns true if the queue was empty before the push
+    bool push(Node *node)
+    {
+        Node *oldHead = head.load(std::memory_order_relaxed);
+        do
+            node->next = oldHead;
+        while (!head.compare_exchange_weak(oldHead, node, std::memory_order_release, std::memory_order_relaxed));
+        return oldHead == nullptr;
+    }
+
+    // consumer only, takes all queued nodes at once in the order they were pushed
+    Node *popAll()
+    {
+        Node *list = head.exchange(nullptr, std::memory_order_acquire);
+        Node *reversed = nullptr;
+        while (list)
+        {
+            Node *next = list->next;
+            list->next = reversed;
+            reversed = list;
+            list = next;
+        }
+        return reversed;
+    }
+
+    bool empty() const
+    {
+        return head.load(std::memory_order_relaxed) == nullptr;
+    }
+
+private:
+    std::atomic<Node *> head = nullptr;
+};
+
+#endif /* COMPLETIONQUEUE_H */
@@ -3,63 +3,104 @@
 
 #include <coroutine>
 #include <exception>
-#include <type_traits>
-#include <future>
-#include <chrono>
+#include <optional>
 #include <random>
 
 #include "Debug.h"
-
-template <class T>
-struct Promise
+#include "FrameAllocator.h"
+
+// Result (or exception) of a coroutine is stored right in its frame. Coroutines
+// of one connection only ever run on one thread at a time, so there is nothing
+// to synchronize.
+// Coroutines start when awaited (or resumed for the first time) and the awaiting
+// coroutine continues right after the awaited one finishes, without going back
+// to the event loop.
+struct PromiseBase
 {
-    auto get_return_object() { return std::coroutine_handle<Promise>::from_promise(*this); }
+    struct FinalAwaiter
+    {
+        bool await_ready() const noexcept { return false; }
+        template <class P>
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<P> handle) const noexcept
+        {
+            if (auto continuation = handle.promise().continuation)
+                return continuation;
+            return std::noop_coroutine();
+        }
+        void await_resume() const noexcept {}
+    };
+
+    // frames come from the pool of the thread creating the coroutine
+    static void *operator new(size_t size)
+    {
+        return FrameAllocator::allocate(size);
+    }
+    static void operator delete(void *pointer, size_t size) noexcept
+    {
+        FrameAllocator::deallocate(pointer, size);
+    }
+
     auto initial_suspend()
     {
         DEBUG << "starting coroutine";
-        resetColor();
-        return std::suspend_never();
+        return std::suspend_always();
     }
-    auto final_suspend() { return std::suspend_always(); }
+    auto final_suspend() noexcept { return FinalAwaiter(); }
     void unhandled_exception()
     {
         DEBUG << "ending coroutine";
-        resetColor();
-        promise.set_exception(std::current_exception());
+        exception = std::current_exception();
     }
-    template <class U>
-    void return_value(U &&u)
+    void rethrow() const
     {
-        if constexpr (!std::is_same_v<T, void>)
-        {
-            DEBUG << "ending coroutine";
-            resetColor();
-            promise.set_value(std::forward<U>(u));
-        }
+        if (exception)
+            std::rethrow_exception(exception);
     }
-    void return_void()
-    {
-        if constexpr (std::is_same_v<T, void>)
-        {
-            DEBUG << "ending coroutine";
-            resetColor();
-            promise.set_value();
-        }
-    }
-    bool hasValue() const { return future.wait_for(std::chrono::milliseconds(0)) == std::future_status::ready; }
-    T value() { return future.get(); }
     static uint8_t randomColor()
     {
-        static std::random_device rd;
-        static std::mt19937 mt(rd());
-        static std::uniform_int_distribution<uint8_t> random(17, 231);
+        static thread_local std::random_device rd;
+        static thread_local std::mt19937 mt(rd());
+        static thread_local std::uniform_int_distribution<uint8_t> random(17, 231);
         return random(mt);
     }
     void setColor() const { Debug::pushColor(color); }
     static void resetColor() { Debug::popColor(); }
     uint8_t color = randomColor();
-    std::promise<T> promise;
-    std::future<T> future = promise.get_future();
+    std::exception_ptr exception;
+    std::coroutine_handle<> continuation;
+};
+
+template <class T>
+struct Promise : PromiseBase
+{
+    auto get_return_object() { return std::coroutine_handle<Promise>::from_promise(*this); }
+    template <class U>
+    void return_value(U &&u)
+    {
+        DEBUG << "ending coroutine";
+        result.emplace(std::forward<U>(u));
+    }
+    bool hasValue() const { return result || exception; }
+    T value()
+    {
+        rethrow();
+        return std::move(*result);
+    }
+    std::optional<T> result;
+};
+
+template <>
+struct Promise<void> : PromiseBase
+{
+    auto get_return_object() { return std::coroutine_handle<Promise>::from_promise(*this); }
+    void return_void()
+    {
+        DEBUG << "ending coroutine";
+        returned = true;
+    }
+    bool hasValue() const { return returned || exception; }
+    void value() { rethrow(); }
+    bool returned = false;
 };
 
 template <class T>
@@ -136,26 +177,23 @@ public:
 
     bool await_ready() const
     {
-        return hasValue();
+        return done();
     }
 
-    constexpr void await_suspend(std::coroutine_handle<>) const noexcept {}
+    // starts the coroutine, the awaiting one is resumed when it finishes
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) const noexcept
+    {
+        coroutineHandle.promise().continuation = awaiting;
+        return coroutineHandle;
+    }
 
-    Coroutine<T> await_resume()
+    T await_resume() const
     {
-        resume();
-        return std::move(*this);
+        return value();
     }
 
 private:
     std::coroutine_handle<promise_type> coroutineHandle;
 };
 
-// Totally unnecessary syntactic sugar
-#define iterative_co_await(coroutine)       \
-{                                           \
-    while (!coroutine)                      \
-        coroutine = co_await coroutine;     \
-}
-
 #endif /* COROUTINE_H */
@@ -45,7 +45,7 @@ public:
     }
 
 private:
-    static inline std::stack<uint8_t> colors;
+    static inline thread_local std::stack<uint8_t> colors;
 };
 
 #endif /* DEBUG_H */
@@ -1,205 +1,553 @@
 #ifndef EPOLLMANAGER_H
 #define EPOLLMANAGER_H
 
-#include <unordered_map>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <optional>
+#include <utility>
+#include <vector>
 #include <sys/eventfd.h>
+#include <sys/timerfd.h>
 
 #include "error.h"
+#include "CompletionQueue.h"
+#include "FrameAllocator.h"
 #include "Network.h"
+#include "Poller.h"
+#include "TimerWheel.h"
 #include "Coroutine.h"
 
-class Notify
+class EpollManager;
+
+// Suspends the innermost coroutine of a connection task until the connection gets
+// what it waits for (its socket becomes readable or writable, or its notify is
+// delivered), the event loop then resumes that coroutine directly instead of the
+// whole task. Other events of the connection do not resume it.
+class EventAwaiter
 {
 public:
-    using FileDescriptor = int;
-    Notify() : efd(eventfd(0, 0))
+    enum class Wait : uint8_t
     {
-        if (efd == invalid)
-            error("Notify");
-    }
+        readable, writable, completion
+    };
+
+    EventAwaiter(EpollManager *epollManager, uint64_t key, Wait wait)
+        : epollManager(epollManager), key(key), wait(wait) {}
+
+    bool await_ready() const noexcept { return false; }
+    void await_suspend(std::coroutine_handle<> handle) const;
+    void await_resume() const noexcept {}
+
+private:
+    EpollManager *epollManager;
+    uint64_t key;
+    Wait wait;
+};
 
+// Hands a connection back to its event loop from another thread once a job
+// of the connection is finished. The notify itself is the node of the
+// completion queue of the loop, so it must stay in place (in the coroutine
+// frame of the connection task) while a job is running.
+class Notify
+{
+public:
     Notify(const Notify &) = delete;
-    Notify(Notify &&rhs)
+    Notify(Notify &&rhs) = default;
+    Notify &operator=(const Notify &) = delete;
+    Notify &operator=(Notify &&rhs) = default;
+
+    // Safe to call from any thread. The caller must not touch the connection
+    // state afterwards, the event loop may be already done with it.
+    void operator()();
+
+    // awaited by the connection task after it has submitted the job
+    EventAwaiter completion() const
     {
-        efd = rhs.efd;
-        rhs.efd = invalid;
+        return EventAwaiter(epollManager, key, EventAwaiter::Wait::completion);
     }
 
-    Notify &operator=(const Notify &) = delete;
-    Notify &operator=(Notify &&rhs)
+private:
+    Notify(uint64_t key, EpollManager *epollManager)
+        : key(key), epollManager(epollManager) {}
+
+    uint64_t key;
+    EpollManager *epollManager;
+    Notify *next = nullptr;
+
+    friend class EpollManager;
+    friend class CompletionQueue<Notify>;
+};
+
+class EpollManager
+{
+public:
+    // counters of the event loop, useful for tuning maxEvents against the load
+    struct Stats
     {
-        if (efd != invalid)
-            operator()();
-        efd = rhs.efd;
-        rhs.efd = invalid;
-        return *this;
-    }
+        size_t maxEvents = 0;    // current batch size passed to epoll_wait
+        size_t wakeups = 0;      // returns from epoll_wait
+        size_t events = 0;       // events drained in total
+        size_t fullBatches = 0;  // wakeups that filled the whole batch
+        size_t largestBatch = 0;
+        size_t completions = 0;  // finished jobs handed back by the worker threads
+        size_t systemCalls = 0;  // made by the poller (epoll_ctl, epoll_wait or io_uring_enter)
+        size_t reaped = 0;       // connections closed because of a timeout
+        size_t spuriousWakeups = 0; // events of connections waiting for something else
+        size_t frameHits = 0;    // coroutine frames reused from the pool of the loop thread
+        size_t frameMisses = 0;  // coroutine frames allocated with operator new
+
+        double eventsPerWakeup() const
+        {
+            return wakeups ? static_cast<double>(events) / wakeups : 0.0;
+        }
+    };
+
+    static constexpr size_t defaultMaxEvents = 256;
+    // resolution of the connection timeouts
+    static constexpr std::chrono::milliseconds timerTick{100};
 
-    FileDescriptor getFileDescriptor() const
+    EpollManager(size_t maxEvents = defaultMaxEvents, Poller::Backend backend = Poller::Backend::epoll)
+        : poller(Poller::create(backend)), events(std::max<size_t>(maxEvents, 1))
     {
-        return efd;
+        stats.maxEvents = events.size();
+        publishStats();
+
+        // one eventfd per loop wakes it up when the completion queue becomes non-empty
+        wakeupFileDescriptor = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (wakeupFileDescriptor == errorCode)
+            error("eventfd");
+        poller->add(wakeupFileDescriptor, EPOLLIN, toKey(wakeupFileDescriptor, 0));
+
+        // ticks the timer wheel, but only while there are any timeouts set
+        timerFileDescriptor = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+        if (timerFileDescriptor == errorCode)
+            error("timerfd_create");
+        poller->add(timerFileDescriptor, EPOLLIN, toKey(timerFileDescriptor, 0));
     }
 
-    ~Notify()
+    ~EpollManager()
     {
-        if (efd != invalid)
-            operator()();
+        if (timerFileDescriptor != errorCode)
+            close(timerFileDescriptor);
+        if (wakeupFileDescriptor != errorCode)
+            close(wakeupFileDescriptor);
     }
 
-    static constexpr FileDescriptor invalid = -1;
-
-    void operator()() const
+    // for the task of the next addSocket with this socket
+    Notify createNotify(Network::Socket socket)
     {
-        DEBUG << "notify eventfd" << efd;
-        uint64_t buff = 1;
-        if (write(efd, &buff, sizeof(uint64_t)) != sizeof(uint64_t))
-            error("notify");
+        return Notify(keyOf(socket) + (1ULL << 32), this);
     }
 
-    void release()
+    void addSocket(Network::Socket socket, Coroutine<void> &&task)
     {
-        efd = invalid;
+        DEBUG << "adding socket" << socket << "to epoll manager";
+        if (socket < 0)
+            throw std::runtime_error("invalid socket added to epoll manager");
+
+        // descriptors are small and reused, so they index the table directly;
+        // the deque keeps connections in place as it grows (timers link to them)
+        if (static_cast<size_t>(socket) >= connections.size())
+            connections.resize(static_cast<size_t>(socket) + 1);
+
+        Connection &connection = connections[socket];
+        if (connection.task)
+        {
+            if (!*connection.task)
+                throw std::runtime_error("not finished task overriden in epoll manager");
+            release(connection, socket);
+        }
+        // the task is in place before it first runs, so it can already set its timeout
+        connection.generation++;
+        connection.task.emplace(std::move(task));
+
+        // EPOLLOUT is added only once a send would block
+        uint64_t key = toKey(socket, connection.generation);
+        connection.interest = EPOLLIN | EPOLLRDHUP | EPOLLET;
+        poller->add(socket, connection.interest, key);
+        DEBUG << "Starting task for descriptor" << socket;
+        connection.task->resume();
+        finishIfDone(key);
     }
 
-    Notify createCopy()
+    // awaited by the coroutines of the task of the socket when a read would block
+    EventAwaiter readable(Network::Socket socket)
     {
-        return Notify(efd);
+        return EventAwaiter(this, keyOf(socket), EventAwaiter::Wait::readable);
     }
 
-private:
-    Notify(int efd) : efd(efd) {}
+    // awaited by the coroutines of the task of the socket when a write would block
+    EventAwaiter writable(Network::Socket socket)
+    {
+        return EventAwaiter(this, keyOf(socket), EventAwaiter::Wait::writable);
+    }
 
-    static void close(FileDescriptor efd)
+    // The connection is closed (its task destroyed) if the timeout passes before it is
+    // set again or cleared. Zero clears it. Must not be set while a job of the connection
+    // is running on another thread.
+    void setTimeout(Network::Socket socket, std::chrono::milliseconds timeout)
     {
-        if (efd != invalid)
-            if (::close(efd) == errorCode)
-                error("close");
+        Connection *connection = find(keyOf(socket));
+        if (!connection)
+            return;
+
+        TimerWheel::Timer &timer = connection->timer;
+        if (timeout <= std::chrono::milliseconds::zero())
+        {
+            timer.cancel();
+            return;
+        }
+
+        uint64_t now = currentTick();
+        // An empty wheel may be behind the clock, it is only moved forward. A wheel with
+        // timers is left to the next tick, which reaps the ones due in between.
+        if (wheel.empty())
+            wheel.advance(now, [](TimerWheel::Timer &) {});
+        connection->timeout = timeout;
+        timer.data = keyOf(socket);
+        wheel.scheduleAt(timer, now + (timeout + timerTick - std::chrono::milliseconds(1)) / timerTick);
+        startTicking();
     }
 
-    FileDescriptor efd;
-    friend class EpollManager;
-};
+    // sets the timeout of the socket again with the same length, if it is set
+    void restartTimeout(Network::Socket socket)
+    {
+        Connection *connection = find(keyOf(socket));
+        if (connection && connection->timer.isArmed())
+            setTimeout(socket, connection->timeout);
+    }
 
-class EpollManager
-{
-public:
-    EpollManager()
+    // must be called before the loop starts waiting, the poller writes into the events
+    void setMaxEvents(size_t maxEvents)
     {
-        epollFileDescriptor = epoll_create1(EPOLL_CLOEXEC);
-        if (epollFileDescriptor == errorCode)
-            error("epoll_create1");
+        events.resize(std::max<size_t>(maxEvents, 1));
+        stats.maxEvents = events.size();
+        publishStats();
     }
 
-    ~EpollManager()
+    // safe to call from any thread, the counters are as of the end of the last wakeup
+    Stats getStats() const
     {
-        if (epollFileDescriptor != errorCode)
-            close(epollFileDescriptor);
+        Stats current;
+        for (auto counter : counters)
+            current.*counter = std::atomic_ref<size_t>(published.*counter).load(std::memory_order_relaxed);
+        return current;
     }
 
-    void addSocket(Network::Socket socket, Coroutine<void> &&task)
+    void wait()
     {
-        addSocket(socket, Notify::invalid, std::move(task));
+        DEBUG << "waiting";
+        size_t ready = poller->wait(events.data(), events.size());
+        stats.wakeups++;
+        stats.events += ready;
+        stats.largestBatch = std::max(stats.largestBatch, ready);
+        if (ready == events.size())
+            stats.fullBatches++;
+
+        DEBUG << ready << "events ready";
+        for (size_t i = 0; i < ready; i++)
+            handleEvent(events[i]);
+
+        resumeCompleted();
+
+        FrameAllocator::Stats frames = FrameAllocator::getStats();
+        stats.frameHits = frames.hits;
+        stats.frameMisses = frames.misses;
+        stats.systemCalls = poller->getSystemCalls();
+        publishStats();
     }
 
-    void addSocket(Network::Socket socket, Notify::FileDescriptor efd, Coroutine<void> &&task)
+private:
+    void handleEvent(const epoll_event &event)
     {
-        DEBUG << "adding socket" << socket << "to epoll manager";
-        epoll_event event;
+        Network::Socket socket = socketOf(event.data.u64);
 
-        event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
-        event.data.u64 = Descriptors(socket, efd).toUint64();
+        if ((event.events & EPOLLIN) == EPOLLIN)
+            DEBUG << "EPOLLIN event on fd" << socket;
+
+        if ((event.events & EPOLLOUT) == EPOLLOUT)
+            DEBUG << "EPOLLOUT event on fd" << socket;
 
-        if (epoll_ctl(epollFileDescriptor, EPOLL_CTL_ADD, socket, &event) == errorCode)
-            error("epoll_ctl");
+        if ((event.events & EPOLLRDHUP) == EPOLLRDHUP)
+            DEBUG << "EPOLLRDHUP event on fd" << socket;
 
-        if (efd != Notify::invalid)
+        if (socket == wakeupFileDescriptor)
         {
-            event.events = EPOLLIN | EPOLLET;
-            if (epoll_ctl(epollFileDescriptor, EPOLL_CTL_ADD, efd, &event) == errorCode)
-                error("epoll_ctl");
+            // tasks are resumed from the completion queue after the batch
+            uint64_t buff;
+            if (read(wakeupFileDescriptor, &buff, sizeof(uint64_t)) == errorCode && errno != EAGAIN)
+                error("read eventfd");
+            return;
         }
 
-        task.resume();
-        if (task.hasValue())
-            task.value();
-
-        auto it = tasks.find(socket);
-        if (it != tasks.end())
+        if (socket == timerFileDescriptor)
         {
-            if (!it->second)
-                throw std::runtime_error("not finished task overriden in epoll manager");
-            it->second = std::move(task);
+            handleTimer();
+            return;
         }
-        else
-            tasks.emplace(socket, std::move(task));
+
+        resumeTask(event.data.u64, event.events);
     }
 
-    void wait()
+    static constexpr size_t Stats::*counters[] = {
+        &Stats::maxEvents, &Stats::wakeups, &Stats::events, &Stats::fullBatches, &Stats::largestBatch,
+        &Stats::completions, &Stats::systemCalls, &Stats::reaped, &Stats::spuriousWakeups,
+        &Stats::frameHits, &Stats::frameMisses
+    };
+
+    // the loop counts in stats and copies them for the other threads once per wakeup
+    void publishStats()
     {
-        DEBUG << "waiting";
-        epoll_event event;
-        code = epoll_wait(epollFileDescriptor, &event, 1, -1);
-        if (code == errorCode)
-            error("epoll_wait");
+        for (auto counter : counters)
+            std::atomic_ref<size_t>(published.*counter).store(stats.*counter, std::memory_order_relaxed);
+    }
 
-        Descriptors descriptors = Descriptors::fromUint64(event.data.u64);
+    uint64_t currentTick() const
+    {
+        return static_cast<uint64_t>((std::chrono::steady_clock::now() - clockStart) / timerTick);
+    }
 
-        if ((event.events & EPOLLIN) == EPOLLIN)
-            DEBUG << "EPOLLIN event on fd" << descriptors.socket << "or" << descriptors.efd;
+    void startTicking()
+    {
+        if (ticking)
+            return;
+        itimerspec spec;
+        std::memset(&spec, 0, sizeof(spec));
+        spec.it_value = spec.it_interval = {0, std::chrono::nanoseconds(timerTick).count()};
+        if (timerfd_settime(timerFileDescriptor, 0, &spec, nullptr) == errorCode)
+            error("timerfd_settime");
+        ticking = true;
+    }
 
-        if ((event.events & EPOLLOUT) == EPOLLOUT)
-            DEBUG << "EPOLLOUT event on fd" << descriptors.socket;
+    void stopTicking()
+    {
+        itimerspec spec;
+        std::memset(&spec, 0, sizeof(spec));
+        if (timerfd_settime(timerFileDescriptor, 0, &spec, nullptr) == errorCode)
+            error("timerfd_settime");
+        ticking = false;
+    }
 
-        if ((event.events & EPOLLRDHUP) == EPOLLRDHUP)
-            DEBUG << "EPOLLRDHUP event on fd" << descriptors.socket;
+    void handleTimer()
+    {
+        uint64_t expirations;
+        if (read(timerFileDescriptor, &expirations, sizeof(uint64_t)) == errorCode && errno != EAGAIN)
+            error("read timerfd");
+
+        wheel.advance(currentTick(), [this](TimerWheel::Timer &timer) {
+            reap(timer.data);
+        });
+        if (wheel.empty())
+            stopTicking();
+    }
+
+    void reap(uint64_t key)
+    {
+        Connection *connection = find(key);
+        if (!connection)
+            return;
+
+        Network::Socket socket = socketOf(key);
+        DEBUG << "connection on socket" << socket << "timed out";
+        // the task closes the socket when destroyed, shutting it down in both directions
+        // first lets the close skip waiting for the peer
+        shutdown(socket, SHUT_RDWR);
+        release(*connection, socket);
+        stats.reaped++;
+    }
 
-        auto it = tasks.find(descriptors.socket);
-        if (!it->second)
+    // called by Notify from worker threads
+    void complete(Notify *notify)
+    {
+        // only the push to an empty queue has to wake the loop up, the next ones
+        // will be taken together with it
+        if (completions.push(notify))
         {
-            DEBUG << "Resuming task for descriptor" << descriptors.socket;
-            it->second.resume();
-            if (it->second.hasValue())
-                it->second.value();
-                
-            if (it->second)
-            {
-                DEBUG << "socket" << it->first << "erased from epoll manager";
-                tasks.erase(it);
-                Notify::close(descriptors.efd);
-            }
+            DEBUG << "notify eventfd" << wakeupFileDescriptor;
+            uint64_t buff = 1;
+            if (write(wakeupFileDescriptor, &buff, sizeof(uint64_t)) != sizeof(uint64_t))
+                error("notify");
         }
-        else
-            throw std::runtime_error("there is finished task not removed from epoll manager");
     }
 
-private:
-    struct Descriptors
+    void resumeCompleted()
     {
-        Network::Socket socket;
-        Notify::FileDescriptor efd;
+        Notify *notify = completions.popAll();
+        while (notify)
+        {
+            // resumed task may queue the notify again or even destroy it
+            Notify *next = notify->next;
+            stats.completions++;
+            DEBUG << "job completed for socket" << socketOf(notify->key);
+            resumeTask(notify->key, completionEvent);
+            notify = next;
+        }
+    }
 
-        Descriptors() = default;
-        Descriptors(Network::Socket s, Notify::FileDescriptor e)
-            : socket(s), efd(e) {}
+    void resumeTask(uint64_t key, uint32_t events)
+    {
+        Network::Socket socket = socketOf(key);
+        // an earlier event of the same batch may have already finished the task,
+        // or even a new connection may have got the same descriptor since then
+        Connection *connection = find(key);
+        if (!connection)
+        {
+            DEBUG << "no task for descriptor" << socket << "- event ignored";
+            return;
+        }
+
+        if (*connection->task)
+            throw std::runtime_error("there is finished task not removed from epoll manager");
 
-        static Descriptors fromUint64(uint64_t u64)
+        // only the coroutine waiting for the event is resumed, the ones awaiting
+        // it continue by themselves once it finishes
+        if (!connection->waiting)
+        {
+            DEBUG << "task for descriptor" << socket << "is not waiting - event ignored";
+            return;
+        }
+        if (!(events & wakingEvents(connection->wait)))
         {
-            static_assert(sizeof(Descriptors) == sizeof(uint64_t));
-            Descriptors descriptors;
-            std::memcpy(&descriptors, &u64, sizeof(Descriptors));
-            return descriptors;
+            DEBUG << "task for descriptor" << socket << "waits for something else - event ignored";
+            stats.spuriousWakeups++;
+            return;
         }
+        std::coroutine_handle<> waiting = std::exchange(connection->waiting, {});
+        DEBUG << "Resuming task for descriptor" << socket;
+        waiting.resume();
+        finishIfDone(key);
+    }
 
-        uint64_t toUint64() const
+    void finishIfDone(uint64_t key)
+    {
+        // the task may have already been replaced by another one
+        Connection *connection = find(key);
+        if (!connection || !*connection->task)
+            return;
+
+        Network::Socket socket = socketOf(key);
+        DEBUG << "socket" << socket << "erased from epoll manager";
+        Coroutine<void> task = std::move(*connection->task);
+        release(*connection, socket);
+        // rethrows an exception which ended the task
+        task.value();
+    }
+
+    void suspendUntil(uint64_t key, EventAwaiter::Wait wait, std::coroutine_handle<> handle)
+    {
+        Connection *connection = find(key);
+        if (!connection)
+            throw std::runtime_error("awaiting an event of a socket not in epoll manager");
+        connection->waiting = handle;
+        connection->wait = wait;
+
+        // edge triggered, so EPOLLOUT may stay armed once it is needed, it fires only
+        // when a full send buffer drains; modifying reports the socket if it is already writable
+        if (wait == EventAwaiter::Wait::writable && !(connection->interest & EPOLLOUT))
         {
-            static_assert(sizeof(Descriptors) == sizeof(uint64_t));
-            return *reinterpret_cast<const uint64_t *>(this);
+            connection->interest |= EPOLLOUT;
+            poller->modify(socketOf(key), connection->interest, key);
         }
+    }
+
+    // marks notifications of finished jobs, epoll never reports this flag (EPOLLONESHOT)
+    static constexpr uint32_t completionEvent = 1u << 30;
+
+    static uint32_t wakingEvents(EventAwaiter::Wait wait)
+    {
+        switch (wait)
+        {
+        case EventAwaiter::Wait::readable:
+            return EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR;
+        case EventAwaiter::Wait::writable:
+            return EPOLLOUT | EPOLLHUP | EPOLLERR;
+        default:
+            return completionEvent;
+        }
+    }
+
+    struct Connection
+    {
+        std::optional<Coroutine<void>> task;
+        // the innermost suspended coroutine of the task and what it waits for
+        std::coroutine_handle<> waiting;
+        EventAwaiter::Wait wait = EventAwaiter::Wait::readable;
+        uint32_t interest = 0;
+        TimerWheel::Timer timer;
+        std::chrono::milliseconds timeout{};
+        // counts the connections which had this descriptor, events and
+        // notifications of the previous ones carry an older generation
+        uint32_t generation = 0;
     };
 
-    int epollFileDescriptor = -1;
-    int code = errorCode;
-    std::unordered_map<Network::Socket, Coroutine<void>> tasks;
+    // the data of the poller events: the descriptor in the low half, its generation in the high one
+    static uint64_t toKey(Network::Socket socket, uint32_t generation)
+    {
+        return static_cast<uint64_t>(generation) << 32 | static_cast<uint32_t>(socket);
+    }
+
+    static Network::Socket socketOf(uint64_t key)
+    {
+        return static_cast<Network::Socket>(static_cast<uint32_t>(key));
+    }
+
+    // key of the current connection of the socket
+    uint64_t keyOf(Network::Socket socket) const
+    {
+        if (socket < 0 || static_cast<size_t>(socket) >= connections.size())
+            return toKey(socket, 0);
+        return toKey(socket, connections[socket].generation);
+    }
+
+    Connection *find(uint64_t key)
+    {
+        size_t index = static_cast<uint32_t>(key);
+        if (index >= connections.size())
+            return nullptr;
+        Connection &connection = connections[index];
+        if (!connection.task || toKey(socketOf(key), connection.generation) != key)
+            return nullptr;
+        return &connection;
+    }
+
+    // destroys the task (which closes the socket) and frees the slot for the next connection
+    void release(Connection &connection, Network::Socket socket)
+    {
+        connection.timer.cancel();
+        connection.waiting = {};
+        connection.task.reset();
+        poller->remove(socket, toKey(socket, connection.generation));
+    }
+
+    std::unique_ptr<Poller> poller;
+    int wakeupFileDescriptor = -1;
+    int timerFileDescriptor = -1;
+    std::vector<epoll_event> events;
+    Stats stats;
+    // written only by publishStats, read by getStats
+    mutable Stats published;
+
+    TimerWheel wheel;
+    const std::chrono::steady_clock::time_point clockStart = std::chrono::steady_clock::now();
+    bool ticking = false;
+
+    std::deque<Connection> connections;
+    CompletionQueue<Notify> completions;
+
+    friend class Notify;
+    friend class EventAwaiter;
 };
 
+inline void Notify::operator()()
+{
+    epollManager->complete(this);
+}
+
+inline void EventAwaiter::await_suspend(std::coroutine_handle<> handle) const
+{
+    epollManager->suspendUntil(key, wait, handle);
+}
+
 #endif /* EPOLLMANAGER_H */
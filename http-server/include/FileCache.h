@@ -0,0 +1,636 @@
+#ifndef FILECACHE_H
+#define FILECACHE_H
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cerrno>
+#include <cstdio>
+#include <ctime>
+#include <deque>
+#include <fcntl.h>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <poll.h>
+#include <string>
+#include <string_view>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+#include <unordered_map>
+#include <unordered_set>
+#include <zlib.h>
+
+#include "Debug.h"
+
+// Files served by the server, opened on first access and shared by all event loops.
+// Files up to maxLoadedSize are read into memory the cache owns and sent together
+// with the header of a response, so what is sent always matches the Content-Length
+// and ETag made from those bytes, whatever happens to the file on the disk. Larger
+// ones are streamed with sendfile from their descriptor (it takes an explicit offset,
+// so responses can share one). The least recently used files are dropped when the
+// loaded bytes exceed the byte budget or too many files are open; responses still
+// sending a dropped file keep it until they are done.
+// Loaded files may also be kept compressed, the compressed variants count towards
+// the budget too. Reading, hashing and compressing are done by a thread of the cache,
+// so an event loop opening a file only opens and stats it: until the thread has read
+// it, the new file is streamed. The thread also watches the directories of cached
+// files with inotify and opens files changed, replaced or deleted on the disk again,
+// the version cached before is served until the new one is read.
+class FileCache
+{
+public:
+    enum class Encoding
+    {
+        identity, gzip, deflate
+    };
+
+    class File
+    {
+    public:
+        // with load a file small enough is read into memory, which takes long for large files
+        File(int fd, const struct stat &status, bool load)
+            : fd(fd), size(static_cast<size_t>(status.st_size)), modified(status.st_mtime)
+        {
+            if (load && isLoadable())
+                this->load();
+            makeValidators(status);
+        }
+
+        File(const File &) = delete;
+        File &operator=(const File &) = delete;
+
+        ~File()
+        {
+            delete variants.load(std::memory_order_relaxed);
+            ::close(fd);
+        }
+
+        bool isLoaded() const
+        {
+            return data != nullptr;
+        }
+
+        bool isLoadable() const
+        {
+            return size > 0 && size <= maxLoadedSize;
+        }
+
+        // Has the gzip and deflate variants, only if they are smaller than the file.
+        // They are added once while the file is already served, never taken away.
+        bool isCompressed() const
+        {
+            return variants.load(std::memory_order_acquire) != nullptr;
+        }
+
+        // the whole file, only for loaded files
+        std::string_view content(Encoding encoding = Encoding::identity) const
+        {
+            if (encoding == Encoding::identity)
+                return std::string_view(data.get(), data ? size : 0);
+            const Variants *compressed = variants.load(std::memory_order_acquire);
+            if (!compressed)
+                return {};
+            return encoding == Encoding::gzip ? compressed->gzipped : compressed->deflated;
+        }
+
+        size_t length(Encoding encoding) const
+        {
+            return encoding == Encoding::identity ? size : content(encoding).size();
+        }
+
+        // strong entity tag of the variant, with the quotes
+        const std::string &etag(Encoding encoding) const
+        {
+            return etags[static_cast<size_t>(encoding)];
+        }
+
+        // modified as an HTTP date
+        const std::string &lastModified() const
+        {
+            return lastModifiedDate;
+        }
+
+        const int fd;
+        const size_t size;
+        const std::time_t modified;
+
+    private:
+        struct Variants
+        {
+            std::string gzipped;
+            std::string deflated;
+        };
+
+        // Reads the file from the start, a file which got shorter meanwhile is streamed
+        // instead. One which got longer is cut to the size the validators are made for.
+        void load()
+        {
+            auto buffer = std::make_unique_for_overwrite<char[]>(size);
+            size_t loaded = 0;
+            while (loaded < size)
+            {
+                ssize_t length = pread(fd, buffer.get() + loaded, size - loaded, static_cast<off_t>(loaded));
+                if (length < 0 && errno == EINTR)
+                    continue;
+                if (length <= 0)
+                    return;
+                loaded += static_cast<size_t>(length);
+            }
+            data = std::move(buffer);
+        }
+
+        // Loaded files are identified by a hash of their content, so a file written again
+        // with the same bytes keeps its tag. The others, large ones and those not read
+        // yet, get a tag made of the inode, size and modification time instead.
+        void makeValidators(const struct stat &status)
+        {
+            uint64_t hash = 14695981039346656037ull;
+            auto add = [&hash](const char *bytes, size_t length) {
+                for (size_t i = 0; i < length; i++)
+                    hash = (hash ^ static_cast<unsigned char>(bytes[i])) * 1099511628211ull;
+            };
+            if (data)
+                add(data.get(), size);
+            else
+            {
+                std::array<uint64_t, 4> identity = {
+                    static_cast<uint64_t>(status.st_ino), static_cast<uint64_t>(size),
+                    static_cast<uint64_t>(status.st_mtim.tv_sec), static_cast<uint64_t>(status.st_mtim.tv_nsec)};
+                add(reinterpret_cast<const char *>(identity.data()), sizeof(identity));
+            }
+
+            char tag[17];
+            std::snprintf(tag, sizeof(tag), "%016llx", static_cast<unsigned long long>(hash));
+            etags[0] = '"' + std::string(tag) + '"';
+            etags[1] = '"' + std::string(tag) + "-gzip\"";
+            etags[2] = '"' + std::string(tag) + "-deflate\"";
+
+            char date[64];
+            std::tm time;
+            gmtime_r(&modified, &time);
+            lastModifiedDate.assign(date, std::strftime(date, sizeof(date), "%a, %d %b %Y %H:%M:%S GMT", &time));
+        }
+
+        // Both encodings are the same deflate stream, only wrapped differently.
+        // Takes long for large files, so it runs on the thread of the cache.
+        std::unique_ptr<Variants> compressContent() const
+        {
+            z_stream stream{};
+            if (deflateInit2(&stream, Z_BEST_COMPRESSION, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+                return nullptr;
+            std::string raw(deflateBound(&stream, size), '\0');
+            stream.next_in = reinterpret_cast<Bytef *>(data.get());
+            stream.avail_in = static_cast<uInt>(size);
+            stream.next_out = reinterpret_cast<Bytef *>(raw.data());
+            stream.avail_out = static_cast<uInt>(raw.size());
+            int result = deflate(&stream, Z_FINISH);
+            raw.resize(stream.total_out);
+            deflateEnd(&stream);
+            // already compressed formats do not get any smaller
+            if (result != Z_STREAM_END || raw.size() + gzipOverhead >= size)
+                return nullptr;
+
+            const Bytef *bytes = reinterpret_cast<const Bytef *>(data.get());
+            uLong crc = crc32(0, bytes, static_cast<uInt>(size));
+            uLong adler = adler32(1, bytes, static_cast<uInt>(size));
+
+            auto compressed = std::make_unique<Variants>();
+            // RFC 1952: magic, deflate, no flags, no time, maximum compression, unix
+            compressed->gzipped.assign("\x1f\x8b\x08\x00\x00\x00\x00\x00\x02\x03", 10);
+            compressed->gzipped += raw;
+            appendLittleEndian(compressed->gzipped, crc);
+            appendLittleEndian(compressed->gzipped, size);
+
+            // RFC 1950: 32 KiB window, maximum compression, then adler32 in network order
+            compressed->deflated.assign("\x78\xda", 2);
+            compressed->deflated += raw;
+            for (int shift = 24; shift >= 0; shift -= 8)
+                compressed->deflated += static_cast<char>((adler >> shift) & 0xff);
+            return compressed;
+        }
+
+        static void appendLittleEndian(std::string &string, uLong value)
+        {
+            for (int i = 0; i < 4; i++)
+                string += static_cast<char>((value >> (8 * i)) & 0xff);
+        }
+
+        static constexpr size_t gzipOverhead = 18;
+
+        std::unique_ptr<char[]> data;
+        // set once by the thread of the cache, under the lock of the cache
+        mutable std::atomic<const Variants *> variants = nullptr;
+        std::array<std::string, 3> etags;
+        std::string lastModifiedDate;
+
+        friend class FileCache;
+    };
+
+    struct Stats
+    {
+        size_t hits = 0;
+        size_t misses = 0;
+        size_t evictions = 0;
+        size_t invalidations = 0;  // files opened again because they changed on the disk
+        size_t files = 0;
+        size_t loadedBytes = 0;
+        size_t compressedBytes = 0;
+        size_t loads = 0;           // versions of files read by the thread of the cache so far
+        size_t compressions = 0;    // versions of files compressed so far
+    };
+
+    static constexpr size_t maxLoadedSize = 4 << 20;
+    // smaller files are never compressed, the headers would take most of the gain
+    static constexpr size_t minCompressedSize = 256;
+    static constexpr size_t defaultByteBudget = 64 << 20;
+    static constexpr size_t defaultMaxOpenFiles = 256;
+
+    FileCache(size_t byteBudget = defaultByteBudget, size_t maxOpenFiles = defaultMaxOpenFiles)
+        : byteBudget(byteBudget), maxOpenFiles(std::max<size_t>(maxOpenFiles, 1)) {}
+
+    FileCache(const FileCache &) = delete;
+    FileCache &operator=(const FileCache &) = delete;
+
+    ~FileCache()
+    {
+        if (worker.joinable())
+        {
+            {
+                std::lock_guard lock(mutex);
+                stopping = true;
+            }
+            // a compression already running is finished first
+            if (wake())
+                worker.join();
+            else
+                worker.detach();
+        }
+        if (inotifyFileDescriptor != -1)
+            ::close(inotifyFileDescriptor);
+        if (wakeFileDescriptor != -1)
+            ::close(wakeFileDescriptor);
+    }
+
+    // Path should be absolute and normalized, returns nullptr if it is not a readable regular file.
+    // A file opened for the first time is read by the thread of the cache, and with compress
+    // its compressed variants are made there too, once for each version of the file. Until
+    // they are ready the file is served as it is.
+    std::shared_ptr<const File> open(const std::string &path, bool compress = false)
+    {
+        bool background;
+        {
+            std::lock_guard lock(mutex);
+            auto it = files.find(path);
+            if (it != files.end())
+            {
+                stats.hits++;
+                recentlyUsed.splice(recentlyUsed.begin(), recentlyUsed, it->second.position);
+                return it->second.file;
+            }
+            startWorker();
+            background = wakeFileDescriptor != -1;
+        }
+
+        // opened outside of the lock, another thread may have opened it meanwhile
+        auto file = openFile(path, !background);
+        if (!file)
+            return nullptr;
+
+        std::lock_guard lock(mutex);
+        auto [it, inserted] = files.try_emplace(path);
+        if (!inserted)
+            return it->second.file;
+
+        stats.misses++;
+        recentlyUsed.push_front(path);
+        it->second = {file, recentlyUsed.begin(), compress};
+        if (file->isLoaded())
+            stats.loadedBytes += file->size;
+        watch(path);
+        if (background && file->isLoadable())
+            queueLoad(it);
+        evict();
+        return file;
+    }
+
+    Stats getStats() const
+    {
+        std::lock_guard lock(mutex);
+        Stats current = stats;
+        current.files = files.size();
+        return current;
+    }
+
+private:
+    struct Entry
+    {
+        std::shared_ptr<const File> file;
+        std::list<std::string>::iterator position;
+        bool compress = false;
+        bool loading = false;   // queued to be read by the thread of the cache
+    };
+
+    using Iterator = std::unordered_map<std::string, Entry>::iterator;
+
+    struct Pending
+    {
+        std::string path;
+        std::weak_ptr<const File> file;
+    };
+
+    static size_t compressedSize(const File &file)
+    {
+        return file.content(Encoding::gzip).size() + file.content(Encoding::deflate).size();
+    }
+
+    // nullptr if it is not a readable regular file
+    static std::shared_ptr<const File> openFile(const std::string &path, bool load)
+    {
+        int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd == -1)
+        {
+            DEBUG << "cannot open file" << path;
+            return nullptr;
+        }
+        struct stat status;
+        if (fstat(fd, &status) == -1 || !S_ISREG(status.st_mode))
+        {
+            ::close(fd);
+            return nullptr;
+        }
+        return std::make_shared<const File>(fd, status, load);
+    }
+
+    // the most recently used file stays even if it alone is over the budget
+    void evict()
+    {
+        while (files.size() > 1 && (files.size() > maxOpenFiles || stats.loadedBytes + stats.compressedBytes > byteBudget))
+        {
+            stats.evictions++;
+            erase(files.find(recentlyUsed.back()));
+        }
+    }
+
+    // the bytes of the version in memory, under the lock
+    static size_t loadedSize(const File &file)
+    {
+        return file.isLoaded() ? file.size : 0;
+    }
+
+    void erase(Iterator it)
+    {
+        stats.loadedBytes -= loadedSize(*it->second.file);
+        stats.compressedBytes -= compressedSize(*it->second.file);
+        recentlyUsed.erase(it->second.position);
+        files.erase(it);
+    }
+
+    // the version served until now is kept by the responses still sending it
+    void replace(Iterator it, std::shared_ptr<const File> file)
+    {
+        stats.loadedBytes -= loadedSize(*it->second.file);
+        stats.compressedBytes -= compressedSize(*it->second.file);
+        stats.loadedBytes += loadedSize(*file);
+        it->second.file = std::move(file);
+    }
+
+    // the thread of the cache opens and reads the file again, under the lock
+    void queueLoad(Iterator it)
+    {
+        if (it->second.loading)
+            return;
+        it->second.loading = true;
+        pendingLoads.push_back({it->first, it->second.file});
+        wake();
+    }
+
+    // opens the file again, or everything under it when it is a directory
+    void invalidate(const std::string &path)
+    {
+        std::string prefix = path + '/';
+        for (auto it = files.begin(); it != files.end(); ++it)
+        {
+            if (it->first == path || it->first.starts_with(prefix))
+            {
+                DEBUG << "file" << it->first << "changed, opened again";
+                stats.invalidations++;
+                queueLoad(it);
+            }
+        }
+    }
+
+    // starts the thread of the cache with the first file, under the lock
+    void startWorker()
+    {
+        if (worker.joinable() || workerFailed)
+            return;
+        wakeFileDescriptor = eventfd(0, EFD_CLOEXEC);
+        if (wakeFileDescriptor == -1)
+        {
+            DEBUG << "eventfd not available, files will not be compressed nor reloaded";
+            workerFailed = true;
+            return;
+        }
+        inotifyFileDescriptor = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if (inotifyFileDescriptor == -1)
+            DEBUG << "inotify not available, changed files will not be reloaded";
+        worker = std::thread([this] { work(); });
+    }
+
+    bool wake()
+    {
+        uint64_t buff = 1;
+        return write(wakeFileDescriptor, &buff, sizeof(buff)) == sizeof(buff);
+    }
+
+    // watches the directory of the file, under the lock
+    void watch(const std::string &path)
+    {
+        std::string directory = path.substr(0, path.rfind('/'));
+        if (directory.empty() || watchedDirectories.count(directory) || inotifyFileDescriptor == -1)
+            return;
+
+        int watchDescriptor = inotify_add_watch(inotifyFileDescriptor, directory.c_str(),
+            IN_CLOSE_WRITE | IN_MODIFY | IN_ATTRIB | IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO |
+            IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR);
+        if (watchDescriptor == -1)
+        {
+            DEBUG << "cannot watch directory" << directory;
+            return;
+        }
+        watchedDirectories.insert(directory);
+        watches[watchDescriptor] = directory;
+    }
+
+    // poll skips the inotify descriptor when it is -1
+    void work()
+    {
+        alignas(inotify_event) char buffer[4096];
+        while (true)
+        {
+            pollfd descriptors[2] = {{wakeFileDescriptor, POLLIN, 0}, {inotifyFileDescriptor, POLLIN, 0}};
+            if (poll(descriptors, 2, -1) == -1)
+            {
+                if (errno == EINTR)
+                    continue;
+                return;
+            }
+            if (descriptors[0].revents)
+            {
+                uint64_t count;
+                if (read(wakeFileDescriptor, &count, sizeof(count)) != sizeof(count))
+                    return;
+            }
+            ssize_t length;
+            while (descriptors[1].revents && (length = read(inotifyFileDescriptor, buffer, sizeof(buffer))) > 0)
+            {
+                std::lock_guard lock(mutex);
+                for (char *position = buffer; position < buffer + length;)
+                {
+                    const inotify_event *event = reinterpret_cast<const inotify_event *>(position);
+                    position += sizeof(inotify_event) + event->len;
+                    handleChange(*event);
+                }
+            }
+            // the changes queue loads without waking the thread
+            if (!loadPending() || !compressPending())
+                return;
+        }
+    }
+
+    // Opens and reads the queued files outside of the lock, one at a time, and puts
+    // them in place of the versions they were queued for, unless those were dropped
+    // or replaced meanwhile. A file which cannot be opened any more is dropped.
+    // Returns false when the cache is being destroyed.
+    bool loadPending()
+    {
+        while (true)
+        {
+            Pending pending;
+            {
+                std::lock_guard lock(mutex);
+                if (stopping)
+                    return false;
+                if (pendingLoads.empty())
+                    return true;
+                pending = std::move(pendingLoads.front());
+                pendingLoads.pop_front();
+                auto it = files.find(pending.path);
+                if (it == files.end() || it->second.file != pending.file.lock())
+                    continue;
+                // a change from now on queues the file again
+                it->second.loading = false;
+            }
+            auto file = openFile(pending.path, true);
+
+            std::lock_guard lock(mutex);
+            auto it = files.find(pending.path);
+            if (it == files.end() || it->second.file != pending.file.lock())
+                continue;
+            if (!file)
+            {
+                erase(it);
+                continue;
+            }
+            stats.loads += file->isLoaded();
+            replace(it, file);
+            if (it->second.compress && file->isLoaded() && file->size >= minCompressedSize)
+                pendingCompressions.push_back({pending.path, file});
+            evict();
+        }
+    }
+
+    // Compresses the queued files outside of the lock, one at a time, skipping those
+    // dropped from the cache meanwhile. Returns false when the cache is being destroyed.
+    bool compressPending()
+    {
+        while (true)
+        {
+            std::string path;
+            std::shared_ptr<const File> file;
+            {
+                std::lock_guard lock(mutex);
+                if (stopping)
+                    return false;
+                if (pendingCompressions.empty())
+                    return true;
+                Pending pending = std::move(pendingCompressions.front());
+                pendingCompressions.pop_front();
+                auto it = files.find(pending.path);
+                if (it == files.end() || it->second.file != pending.file.lock())
+                    continue;
+                path = std::move(pending.path);
+                file = it->second.file;
+            }
+            auto variants = file->compressContent();
+            if (!variants)
+                continue;
+
+            std::lock_guard lock(mutex);
+            file->variants.store(variants.release(), std::memory_order_release);
+            stats.compressions++;
+            auto it = files.find(path);
+            if (it != files.end() && it->second.file == file)
+            {
+                stats.compressedBytes += compressedSize(*file);
+                evict();
+            }
+        }
+    }
+
+    // under the lock
+    void handleChange(const inotify_event &event)
+    {
+        if (event.mask & IN_Q_OVERFLOW)
+        {
+            for (auto it = files.begin(); it != files.end(); ++it)
+            {
+                stats.invalidations++;
+                queueLoad(it);
+            }
+            return;
+        }
+
+        auto it = watches.find(event.wd);
+        if (it == watches.end())
+            return;
+        const std::string &directory = it->second;
+
+        if (event.len > 0)
+            invalidate(directory + '/' + event.name);
+        // the directory was deleted or moved away, a directory created in its place
+        // gets a new watch with its first cached file
+        if (event.mask & (IN_DELETE_SELF | IN_MOVE_SELF | IN_IGNORED))
+        {
+            invalidate(directory);
+            inotify_rm_watch(inotifyFileDescriptor, event.wd);
+            watchedDirectories.erase(directory);
+            watches.erase(it);
+        }
+    }
+
+    const size_t byteBudget;
+    const size_t maxOpenFiles;
+
+    mutable std::mutex mutex;
+    std::unordered_map<std::string, Entry> files;
+    std::list<std::string> recentlyUsed;
+    Stats stats;
+
+    std::deque<Pending> pendingLoads;
+    std::deque<Pending> pendingCompressions;
+    bool stopping = false;
+
+    int inotifyFileDescriptor = -1;
+    int wakeFileDescriptor = -1;
+    bool workerFailed = false;
+    std::unordered_map<int, std::string> watches;
+    std::unordered_set<std::string> watchedDirectories;
+    std::thread worker;
+};
+
+#endif /* FILECACHE_H */
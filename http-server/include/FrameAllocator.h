@@ -0,0 +1,110 @@
+#ifndef FRAMEALLOCATOR_H
+#define FRAMEALLOCATOR_H
+
+#include <array>
+#include <cstddef>
+#include <new>
+
+// Allocates coroutine frames from thread-local free lists, one list per size class.
+// Every request creates and destroys the same few frames over and over, so after
+// warming up they are just taken from and put back to the lists of the event loop
+// thread. A frame freed on another thread simply goes to that thread's lists.
+class FrameAllocator
+{
+public:
+    struct Stats
+    {
+        size_t hits = 0;     // frames taken from a free list
+        size_t misses = 0;   // frames allocated with operator new
+        size_t cached = 0;   // frames waiting in the free lists
+    };
+
+    static constexpr size_t granularity = 64;
+    static constexpr size_t sizeClasses = 64;   // frames up to 4 KiB are pooled
+    static constexpr size_t maxCachedPerClass = 1024;
+
+    static void *allocate(size_t size)
+    {
+        Pool &pool = getPool();
+        size_t sizeClass = toSizeClass(size);
+        if (sizeClass < sizeClasses)
+        {
+            if (Block *block = pool.freeLists[sizeClass])
+            {
+                pool.freeLists[sizeClass] = block->next;
+                pool.cached[sizeClass]--;
+                pool.stats.hits++;
+                return block;
+            }
+            size = (sizeClass + 1) * granularity;
+        }
+        pool.stats.misses++;
+        return ::operator new(size);
+    }
+
+    static void deallocate(void *pointer, size_t size) noexcept
+    {
+        Pool &pool = getPool();
+        size_t sizeClass = toSizeClass(size);
+        if (sizeClass < sizeClasses && pool.cached[sizeClass] < maxCachedPerClass)
+        {
+            Block *block = static_cast<Block *>(pointer);
+            block->next = pool.freeLists[sizeClass];
+            pool.freeLists[sizeClass] = block;
+            pool.cached[sizeClass]++;
+            return;
+        }
+        ::operator delete(pointer);
+    }
+
+    // counters of the calling thread
+    static Stats getStats()
+    {
+        Pool &pool = getPool();
+        Stats stats = pool.stats;
+        for (size_t count : pool.cached)
+            stats.cached += count;
+        return stats;
+    }
+
+private:
+    struct Block
+    {
+        Block *next;
+    };
+
+    struct Pool
+    {
+        Pool() = default;
+        Pool(const Pool &) = delete;
+        Pool &operator=(const Pool &) = delete;
+
+        ~Pool()
+        {
+            for (Block *block : freeLists)
+                while (block)
+                {
+                    Block *next = block->next;
+                    ::operator delete(block);
+                    block = next;
+                }
+        }
+
+        std::array<Block *, sizeClasses> freeLists{};
+        std::array<size_t, sizeClasses> cached{};
+        Stats stats;
+    };
+
+    static size_t toSizeClass(size_t size)
+    {
+        return size ? (size - 1) / granularity : 0;
+    }
+
+    static Pool &getPool()
+    {
+        static thread_local Pool pool;
+        return pool;
+    }
+};
+
+#endif /* FRAMEALLOCATOR_H */
@@ -0,0 +1,308 @@
+#ifndef HTTPHEADERS_H
+#define HTTPHEADERS_H
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// the headers looked up by the server and sent by most clients, in alphabetical order
+enum class HeaderName : uint8_t
+{
+    accept, acceptCharset, acceptEncoding, acceptLanguage, acceptRanges,
+    accessControlAllowHeaders, accessControlAllowMethods, accessControlAllowOrigin,
+    accessControlRequestHeaders, accessControlRequestMethod,
+    age, allow, authorization, cacheControl, connection, contentDisposition, contentEncoding,
+    contentLength, contentRange, contentType, cookie, date, etag, expect, expires, host,
+    ifMatch, ifModifiedSince, ifNoneMatch, ifRange, ifUnmodifiedSince, lastModified,
+    location, origin, range, referer, server, setCookie, transferEncoding, upgrade,
+    userAgent, vary, xForwardedFor,
+    unknown
+};
+
+// Maps a header name in any case to a HeaderName with one hash and one comparison.
+// The hash of the lowercase name is perfect for the known names: its seed is
+// searched at compile time so that each of them gets a slot of its own.
+class HeaderNames
+{
+public:
+    static constexpr size_t count = static_cast<size_t>(HeaderName::unknown);
+
+    // the spelling the server sends
+    static constexpr std::array<std::string_view, count> names = {
+        "Accept", "Accept-Charset", "Accept-Encoding", "Accept-Language", "Accept-Ranges",
+        "Access-Control-Allow-Headers", "Access-Control-Allow-Methods", "Access-Control-Allow-Origin",
+        "Access-Control-Request-Headers", "Access-Control-Request-Method",
+        "Age", "Allow", "Authorization", "Cache-Control", "Connection", "Content-Disposition", "Content-Encoding",
+        "Content-Length", "Content-Range", "Content-Type", "Cookie", "Date", "ETag", "Expect", "Expires", "Host",
+        "If-Match", "If-Modified-Since", "If-None-Match", "If-Range", "If-Unmodified-Since", "Last-Modified",
+        "Location", "Origin", "Range", "Referer", "Server", "Set-Cookie", "Transfer-Encoding", "Upgrade",
+        "User-Agent", "Vary", "X-Forwarded-For"
+    };
+
+    static std::string_view name(HeaderName header)
+    {
+        return names[static_cast<size_t>(header)];
+    }
+
+    // HeaderName::unknown for the names not in the table
+    static HeaderName find(std::string_view name);
+
+    static constexpr bool equalsIgnoreCase(std::string_view lhs, std::string_view rhs)
+    {
+        return std::equal(lhs.begin(), lhs.end(), rhs.begin(), rhs.end(), [](char a, char b) {
+            return toLower(a) == toLower(b);
+        });
+    }
+
+private:
+    static constexpr size_t tableSize = 256;
+    static constexpr uint8_t emptySlot = 0xff;
+
+    static constexpr size_t maxLength = 32;
+
+    struct Table
+    {
+        uint64_t seed;
+        std::array<uint8_t, tableSize> slots;
+        // each name lowercased, and with bit 5 set where it has a letter
+        std::array<std::array<char, maxLength>, count> lowercase;
+        std::array<std::array<char, maxLength>, count> letters;
+    };
+
+    static constexpr char toLower(char c)
+    {
+        return c >= 'A' && c <= 'Z' ? static_cast<char>(c - 'A' + 'a') : c;
+    }
+
+    // Mixes the first and the last eight bytes (fewer for short names) and the length,
+    // which tell all the known names apart, the slot is in the top bits. Setting bit 5
+    // of every byte lowercases the letters, a name which equals a known one in another
+    // case gets the same hash, anything else is ruled out by the comparison.
+    static constexpr size_t hash(std::string_view name, uint64_t seed)
+    {
+        constexpr uint64_t lowercase = 0x2020202020202020u;
+        uint64_t head = 0;
+        uint64_t tail = 0;
+        // the compiler builds the table byte by byte, which the loads match on little-endian CPUs
+        if (std::endian::native == std::endian::little && name.size() >= 8 && !std::is_constant_evaluated())
+        {
+            std::memcpy(&head, name.data(), 8);
+            std::memcpy(&tail, name.data() + name.size() - 8, 8);
+        }
+        else
+        {
+            size_t length = std::min<size_t>(name.size(), 8);
+            for (size_t i = 0; i < length; i++)
+            {
+                head |= uint64_t(static_cast<uint8_t>(name[i])) << (8 * i);
+                tail |= uint64_t(static_cast<uint8_t>(name[name.size() - length + i])) << (8 * i);
+            }
+        }
+        uint64_t mixed = (((head | lowercase) ^ seed) * 0x9e3779b97f4a7c15u) ^ (((tail | lowercase) + name.size()) * 0xc2b2ae3d27d4eb4fu);
+        return static_cast<size_t>((mixed * 0xff51afd7ed558ccdu) >> 56);
+    }
+
+    // the first seed without two names in one slot
+    static constexpr Table makeTable()
+    {
+        for (uint64_t seed = 0; seed != 65536; seed++)
+        {
+            Table table{seed, {}, {}, {}};
+            table.slots.fill(emptySlot);
+            bool perfect = true;
+            for (size_t i = 0; i < count && perfect; i++)
+            {
+                uint8_t &slot = table.slots[hash(names[i], seed)];
+                perfect = slot == emptySlot;
+                slot = static_cast<uint8_t>(i);
+            }
+            if (!perfect)
+                continue;
+            for (size_t i = 0; i < count; i++)
+            {
+                if (names[i].size() > maxLength)
+                    throw std::logic_error("header name too long");
+                for (size_t j = 0; j < names[i].size(); j++)
+                {
+                    bool letter = toLower(names[i][j]) != names[i][j] || (names[i][j] >= 'a' && names[i][j] <= 'z');
+                    table.lowercase[i][j] = toLower(names[i][j]);
+                    table.letters[i][j] = letter ? 0x20 : 0;
+                }
+            }
+            return table;
+        }
+        throw std::logic_error("no perfect hash for the header names");
+    }
+};
+
+// defined once the class is complete, the table is built by the compiler
+inline HeaderName HeaderNames::find(std::string_view name)
+{
+    static constexpr Table table = makeTable();
+    uint8_t index = table.slots[hash(name, table.seed)];
+    if (index == emptySlot || names[index].size() != name.size())
+        return HeaderName::unknown;
+
+    // A byte with bit 5 set equals a lowercase letter only if it is that letter in
+    // either case, so the name is compared eight bytes at a time, the last word
+    // overlapping the one before it.
+    const char *lowercase = table.lowercase[index].data();
+    const char *letters = table.letters[index].data();
+    auto differs = [&](size_t offset) {
+        uint64_t word, lower, mask;
+        std::memcpy(&word, name.data() + offset, 8);
+        std::memcpy(&lower, lowercase + offset, 8);
+        std::memcpy(&mask, letters + offset, 8);
+        return (word | mask) != lower;
+    };
+    if (name.size() < 8)
+        return equalsIgnoreCase(names[index], name) ? static_cast<HeaderName>(index) : HeaderName::unknown;
+    for (size_t offset = 0; offset + 8 < name.size(); offset += 8)
+        if (differs(offset))
+            return HeaderName::unknown;
+    return differs(name.size() - 8) ? HeaderName::unknown : static_cast<HeaderName>(index);
+}
+
+// Header fields by name, case-insensitive, in the order they were added. The fields
+// are kept in one vector, a known header is found through its slot in a small index
+// and the others by comparing names, so an empty map costs no construction of values.
+// Value is std::string_view for requests, whose values point into the received
+// header, and std::string for responses.
+template <typename Value>
+class HeaderMap
+{
+public:
+    const Value *find(HeaderName name) const
+    {
+        size_t index = static_cast<size_t>(name);
+        return present & (uint64_t(1) << index) ? &fields[positions[index]].value : nullptr;
+    }
+
+    Value *find(HeaderName name)
+    {
+        return const_cast<Value *>(std::as_const(*this).find(name));
+    }
+
+    const Value *find(std::string_view name) const
+    {
+        HeaderName header = HeaderNames::find(name);
+        return header == HeaderName::unknown ? findOther(name) : find(header);
+    }
+
+    Value *find(std::string_view name)
+    {
+        return const_cast<Value *>(std::as_const(*this).find(name));
+    }
+
+    bool contains(HeaderName name) const { return find(name) != nullptr; }
+    bool contains(std::string_view name) const { return find(name) != nullptr; }
+
+    // the value of the header, added empty if it is not there
+    Value &operator[](HeaderName name)
+    {
+        return *emplace(name, Value()).first;
+    }
+
+    Value &operator[](std::string_view name)
+    {
+        return *emplace(name, Value()).first;
+    }
+
+    // Adds the header if it is not there, returns its value and whether it was added.
+    // HeaderName::unknown has no slot, other headers are added by their name.
+    std::pair<Value *, bool> emplace(HeaderName name, Value value)
+    {
+        if (name == HeaderName::unknown)
+            throw std::invalid_argument("HeaderName::unknown cannot be added, use the name of the header");
+        if (Value *existing = find(name))
+            return {existing, false};
+        size_t index = static_cast<size_t>(name);
+        present |= uint64_t(1) << index;
+        positions[index] = static_cast<uint32_t>(fields.size());
+        return {&fields.emplace_back(name, Value(), std::move(value)).value, true};
+    }
+
+    std::pair<Value *, bool> emplace(std::string_view name, Value value)
+    {
+        HeaderName header = HeaderNames::find(name);
+        if (header != HeaderName::unknown)
+            return emplace(header, std::move(value));
+        if (const Value *existing = findOther(name))
+            return {const_cast<Value *>(existing), false};
+        return {&fields.emplace_back(header, Value(name), std::move(value)).value, true};
+    }
+
+    void erase(HeaderName name)
+    {
+        if (contains(name))
+            eraseAt(positions[static_cast<size_t>(name)]);
+    }
+
+    void erase(std::string_view name)
+    {
+        HeaderName header = HeaderNames::find(name);
+        if (header != HeaderName::unknown)
+            return erase(header);
+        for (size_t i = fields.size(); i-- > 0;)
+            if (fields[i].header == HeaderName::unknown && HeaderNames::equalsIgnoreCase(fields[i].name, name))
+                eraseAt(i);
+    }
+
+    size_t size() const { return fields.size(); }
+
+    // adding fields moves the values unless there is room for them
+    void reserve(size_t count)
+    {
+        fields.reserve(count);
+    }
+
+    // calls visit(name, value) for every header, known ones with their usual spelling
+    template <typename Visitor>
+    void forEach(Visitor &&visit) const
+    {
+        for (auto &field : fields)
+            visit(field.header == HeaderName::unknown ? std::string_view(field.name) : HeaderNames::name(field.header), field.value);
+    }
+
+private:
+    static_assert(HeaderNames::count <= 64, "the known headers must fit in the mask");
+
+    struct Field
+    {
+        HeaderName header;
+        Value name;     // empty for the known headers
+        Value value;
+    };
+
+    const Value *findOther(std::string_view name) const
+    {
+        for (auto &field : fields)
+            if (field.header == HeaderName::unknown && HeaderNames::equalsIgnoreCase(field.name, name))
+                return &field.value;
+        return nullptr;
+    }
+
+    void eraseAt(size_t position)
+    {
+        if (fields[position].header != HeaderName::unknown)
+            present &= ~(uint64_t(1) << static_cast<size_t>(fields[position].header));
+        fields.erase(fields.begin() + position);
+        for (size_t i = position; i < fields.size(); i++)
+            if (fields[i].header != HeaderName::unknown)
+                positions[static_cast<size_t>(fields[i].header)]--;
+    }
+
+    uint64_t present = 0;
+    // where each known header is in fields, only meaningful if its bit is set in present
+    std::array<uint32_t, HeaderNames::count> positions;
+    std::vector<Field> fields;
+};
+
+#endif /* HTTPHEADERS_H */
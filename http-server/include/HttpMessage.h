@@ -1,11 +1,15 @@
 #ifndef HTTPMESSAGE_H_
 #define HTTPMESSAGE_H_
 
+#include <chrono>
 #include <string>
+#include <string_view>
 
 #include <nlohmann/json.hpp>
 using json = nlohmann::json;
 
+#include "HttpHeaders.h"
+
 class HttpMessage
 {
 public:
@@ -13,39 +17,59 @@ public:
     inline static const std::string crlf = "\r\n";
     inline static const std::string crlf2 = "\r\n\r\n";
 
+    // after any of them passes the connection is closed, zero disables the limit
+    struct Timeouts
+    {
+        // waiting for the first byte of the next request
+        std::chrono::milliseconds idle = std::chrono::seconds(60);
+        // from the first byte of the request until its header is complete
+        std::chrono::milliseconds headerRead = std::chrono::seconds(10);
+        std::chrono::milliseconds bodyRead = std::chrono::seconds(30);
+        // sending a response without any of it getting out
+        std::chrono::milliseconds write = std::chrono::seconds(30);
+    };
+
     bool isPersistentConnection()
     {
-        auto it = rawHeaders.find("Connection");
-        if (it != rawHeaders.end())
-            return it->second != "close";
+        auto connection = rawHeaders.find(HeaderName::connection);
+        if (connection)
+            return *connection != "close";
         else
             return false;
     }
 
     void closeConnection()
     {
-        rawHeaders["Connection"] = "close";
+        rawHeaders[HeaderName::connection] = "close";
     }
 
     const std::string &getBody() { return body; }
 
 protected:
 
-    HttpMessage(std::unordered_map<std::string, std::string> defaultHeaders = {}) : rawHeaders(std::move(defaultHeaders)) {}
+    HttpMessage(const HeaderMap<std::string> &defaultHeaders = {}) : rawHeaders(defaultHeaders) {}
 
-    std::unordered_map<std::string, std::string> rawHeaders;
+    // names are case-insensitive, the known ones are sent in their usual spelling
+    HeaderMap<std::string> rawHeaders;
     std::string body;
     std::optional<json> jsonBody = {};
 
-    bool hasHeader(const std::string &header) const
+    bool hasHeader(std::string_view header) const
     {
-        return rawHeaders.find(header) != rawHeaders.end();
+        return rawHeaders.contains(header);
     }
-    const std::string &getHeader(const std::string &header) const
+    const std::string &getHeader(std::string_view header) const
     {
-        return rawHeaders.at(header);
+        auto value = rawHeaders.find(header);
+        if (!value)
+            throw std::out_of_range("no header " + std::string(header));
+        return *value;
+    }
+    void setHeader(std::string_view header, const std::string &value)
+    {
+        rawHeaders[header] = value;
     }
-    void setHeader(const std::string &header, const std::string &value)
+    void setHeader(HeaderName header, const std::string &value)
     {
         rawHeaders[header] = value;
     }
@@ -1,12 +1,24 @@
 #ifndef HTTPREQUEST_H_
 #define HTTPREQUEST_H_
 
+#include <algorithm>
+#include <cctype>
+#include <charconv>
 #include <coroutine>
-#include <regex>
+#include <cstring>
+#include <ctime>
+#include <list>
+#include <memory>
+#include <optional>
+#include <span>
 #include <string>
+#include <string_view>
+#include <vector>
 
 #include "Coroutine.h"
+#include "HttpHeaders.h"
 #include "HttpMessage.h"
+#include "RequestParser.h"
 #include "TcpClient.h"
 
 class HttpRequest : public HttpMessage
@@ -18,9 +30,35 @@ public:
     };
 
     Method getMethod() const { return method; }
-    const std::string &getUriBase() const { return uriBase; }
-    const std::string &getQuery() const { return query; }
-    const std::string &getHttpVersion() const { return httpVersion; }
+    // percent-decoded, without the trailing slash
+    std::string_view getUriBase() const { return uriBase; }
+    // as it was sent, not decoded
+    std::string_view getQuery() const { return query; }
+    // the first parameter of the query with the name, percent-decoded
+    bool hasQueryParam(std::string_view name) const
+    {
+        return findParameter(getQueryParams(), name) != nullptr;
+    }
+    std::string_view getQueryParam(std::string_view name) const
+    {
+        auto value = findParameter(getQueryParams(), name);
+        if (!value)
+            throw std::out_of_range("no query parameter " + std::string(name));
+        return *value;
+    }
+    // nullopt if the parameter is not there or is not a whole decimal integer
+    std::optional<long long> getQueryInt(std::string_view name) const
+    {
+        auto value = findParameter(getQueryParams(), name);
+        long long number;
+        if (!value)
+            return {};
+        auto [end, error] = std::from_chars(value->data(), value->data() + value->size(), number);
+        if (error != std::errc() || end != value->data() + value->size())
+            return {};
+        return number;
+    }
+    std::string_view getHttpVersion() const { return httpVersion; }
     const std::string &getPathParam(const std::string &name) const
     {
         return pathParams.at(name);
@@ -29,17 +67,187 @@ public:
     {
         return pathParams.find(name) != pathParams.end();
     }
-    const std::string &getContentType() const { return rawHeaders.at("Content-type"); }
+    std::string_view getContentType() const
+    {
+        auto value = findHeader(HeaderName::contentType);
+        return value ? *value : noContentTypeString;
+    }
     Method getmethod() const { return method; }
-    bool hasCookie(const std::string &name) const
+    // cookies are parsed when first asked for, the values are valid as long as the request
+    bool hasCookie(std::string_view name) const
+    {
+        return findParameter(getCookies(), name) != nullptr;
+    }
+    std::string_view getCookie(std::string_view name) const
+    {
+        auto value = findParameter(getCookies(), name);
+        if (!value)
+            throw std::out_of_range("no cookie " + std::string(name));
+        return *value;
+    }
+    // whether the Accept-Encoding header allows the content coding, q=0 refuses it
+    bool acceptsEncoding(std::string_view coding) const
+    {
+        auto value = findHeader(HeaderName::acceptEncoding);
+        if (!value)
+            return false;
+
+        std::optional<bool> wildcard;
+        std::string_view header = *value;
+        while (!header.empty())
+        {
+            size_t end = std::min(header.find(','), header.size());
+            std::string_view item = header.substr(0, end);
+            header.remove_prefix(std::min(end + 1, header.size()));
+
+            size_t parameters = std::min(item.find(';'), item.size());
+            std::string_view name = trim(item.substr(0, parameters));
+            std::string_view quality = trim(item.substr(std::min(parameters + 1, item.size())));
+            // any nonzero digit in the weight means it is not zero
+            bool accepted = !(quality.starts_with("q=") || quality.starts_with("Q="))
+                || quality.find_first_of("123456789", 2) != std::string_view::npos;
+
+            if (HeaderNames::equalsIgnoreCase(name, coding))
+                return accepted;
+            if (name == "*")
+                wildcard = accepted;
+        }
+        return wildcard.value_or(false);
+    }
+    // whether If-None-Match is * or lists the entity tag, W/ prefixes are ignored
+    bool matchesETag(std::string_view etag) const
+    {
+        auto value = findHeader(HeaderName::ifNoneMatch);
+        if (!value)
+            return false;
+
+        std::string_view header = *value;
+        if (header == "*")
+            return true;
+        while (!header.empty())
+        {
+            size_t start = header.find('"');
+            if (start == std::string_view::npos)
+                break;
+            size_t end = header.find('"', start + 1);
+            if (end == std::string_view::npos)
+                break;
+            if (header.substr(start, end - start + 1) == etag)
+                return true;
+            header.remove_prefix(end + 1);
+        }
+        return false;
+    }
+    // whether If-Modified-Since is a valid date not before modified
+    bool isNotModifiedSince(std::time_t modified) const
+    {
+        auto value = findHeader(HeaderName::ifModifiedSince);
+        // strptime needs a terminated string
+        char date[64];
+        if (!value || value->size() >= sizeof(date))
+            return false;
+        value->copy(date, value->size());
+        date[value->size()] = '\0';
+        std::tm time{};
+        const char *end = strptime(date, "%a, %d %b %Y %H:%M:%S GMT", &time);
+        return end && *end == '\0' && modified <= timegm(&time);
+    }
+
+    struct ByteRange
+    {
+        size_t first;
+        size_t last;    // inclusive
+    };
+    static inline constexpr size_t maxRanges = 16;
+
+    // The ranges of the Range header which a representation of length bytes can satisfy,
+    // empty if it cannot satisfy any. Without a valid Range header, or with too many
+    // ranges, it is nullopt and the whole representation should be sent.
+    std::optional<std::vector<ByteRange>> getRanges(size_t length) const
     {
-        return cookies.find(name) != cookies.end();
+        auto value = findHeader(HeaderName::range);
+        if (!value)
+            return {};
+        std::string_view header = *value;
+        if (!header.starts_with("bytes="))
+            return {};
+        header.remove_prefix(6);
+
+        std::vector<ByteRange> ranges;
+        bool valid = false;
+        while (!header.empty())
+        {
+            size_t end = std::min(header.find(','), header.size());
+            std::string_view item = trim(header.substr(0, end));
+            header.remove_prefix(std::min(end + 1, header.size()));
+            if (item.empty())
+                continue;
+
+            size_t dash = item.find('-');
+            if (dash == std::string_view::npos)
+                return {};
+            std::string_view firstText = trim(item.substr(0, dash));
+            std::string_view lastText = trim(item.substr(dash + 1));
+            size_t first, last;
+            if (firstText.empty())
+            {
+                // the last bytes
+                size_t suffix;
+                if (!parseNumber(lastText, suffix))
+                    return {};
+                valid = true;
+                if (suffix == 0 || length == 0)
+                    continue;
+                first = length - std::min(suffix, length);
+                last = length - 1;
+            }
+            else
+            {
+                if (!parseNumber(firstText, first))
+                    return {};
+                if (lastText.empty())
+                    last = length - 1;
+                else if (!parseNumber(lastText, last) || last < first)
+                    return {};
+                valid = true;
+                if (first >= length)
+                    continue;
+                last = std::min(last, length - 1);
+            }
+            if (ranges.size() == maxRanges)
+                return {};
+            ranges.push_back({first, last});
+        }
+        if (!valid)
+            return {};
+        return ranges;
     }
-    const std::string &getCookie(const std::string &name) const { return cookies.at(name); }
-    bool isMalformed() { return malformed; }
+    bool isMalformed() const { return malformed; }
     bool isBodyNotFetched() { return bodyNotFetched; }
-    using HttpMessage::getHeader;
-    using HttpMessage::hasHeader;
+
+    // names are case-insensitive, values are valid as long as the request
+    bool hasHeader(std::string_view name) const
+    {
+        return headers.contains(name);
+    }
+    bool hasHeader(HeaderName name) const
+    {
+        return headers.contains(name);
+    }
+    std::string_view getHeader(std::string_view name) const
+    {
+        auto value = findHeader(name);
+        if (!value)
+            throw std::out_of_range("no header " + std::string(name));
+        return *value;
+    }
+    std::string_view getHeader(HeaderName name) const
+    {
+        auto value = findHeader(name);
+        if (!value)
+            throw std::out_of_range("no header " + std::string(HeaderNames::name(name)));
+        return *value;
+    }
 
     class JsonParseError : public std::invalid_argument
     {
@@ -70,10 +278,16 @@ private:
     bool bodyNotFetched = false;
 
     Method method;
-    std::string uriBase;
-    std::string query;
-    std::string part;
-    std::string httpVersion;
+    // the parts of the request line and the headers point into the received header
+    std::unique_ptr<char[]> header;
+    // trailers of a chunked body and values of headers sent more than once
+    std::list<std::string> extraStorage;
+    HeaderMap<std::string_view> headers;
+    // the value of the last field, which a folded line continues
+    std::string_view *lastValue = nullptr;
+    std::string_view uriBase;
+    std::string_view query;
+    std::string_view httpVersion;
 
     std::string unparsedHeader;
     const std::string &getUnparsedHeader()
@@ -82,10 +296,169 @@ private:
     }
 
     std::unordered_map<std::string, std::string> pathParams;
-    std::unordered_map<std::string, std::string> cookies;
 
-    void setUri(std::string uri)
+    // name and value pairs in the order they were sent
+    using Parameters = std::vector<std::pair<std::string_view, std::string_view>>;
+    mutable std::optional<Parameters> cookies;
+    mutable std::optional<Parameters> queryParams;
+    // the decoded query, only needed if it has escapes
+    mutable std::unique_ptr<char[]> decodedQuery;
+
+    static const std::string_view *findParameter(const Parameters &parameters, std::string_view name)
+    {
+        for (auto &[parameterName, value] : parameters)
+            if (parameterName == name)
+                return &value;
+        return nullptr;
+    }
+
+    // name=value pairs separated by semicolons, values may be quoted
+    const Parameters &getCookies() const
+    {
+        if (cookies)
+            return *cookies;
+        cookies.emplace();
+        auto value = findHeader(HeaderName::cookie);
+        std::string_view header = value ? *value : std::string_view();
+        while (!header.empty())
+        {
+            size_t end = std::min(header.find(';'), header.size());
+            std::string_view pair = header.substr(0, end);
+            header.remove_prefix(std::min(end + 1, header.size()));
+
+            size_t equals = pair.find('=');
+            if (equals == std::string_view::npos)
+                continue;
+            std::string_view name = trim(pair.substr(0, equals));
+            std::string_view cookie = trim(pair.substr(equals + 1));
+            if (cookie.size() >= 2 && cookie.front() == '"' && cookie.back() == '"')
+                cookie = cookie.substr(1, cookie.size() - 2);
+            if (!name.empty())
+                cookies->emplace_back(name, cookie);
+        }
+        return *cookies;
+    }
+
+    // name=value pairs separated by ampersands, a name alone has an empty value
+    const Parameters &getQueryParams() const
+    {
+        if (queryParams)
+            return *queryParams;
+        queryParams.emplace();
+        // the decoded parameters are never longer than the query
+        bool escaped = query.find_first_of("%+") != std::string_view::npos;
+        if (escaped)
+            decodedQuery = std::make_unique_for_overwrite<char[]>(query.size());
+        char *decoded = decodedQuery.get();
+        auto decode = [&](std::string_view component) {
+            if (!escaped)
+                return component;
+            char *begin = decoded;
+            decoded = decodeQueryComponent(component, decoded);
+            return std::string_view(begin, decoded - begin);
+        };
+
+        std::string_view rest = query;
+        while (!rest.empty())
+        {
+            size_t end = std::min(rest.find('&'), rest.size());
+            std::string_view pair = rest.substr(0, end);
+            rest.remove_prefix(std::min(end + 1, rest.size()));
+            if (pair.empty())
+                continue;
+
+            size_t equals = std::min(pair.find('='), pair.size());
+            std::string_view name = decode(pair.substr(0, equals));
+            std::string_view value = decode(pair.substr(std::min(equals + 1, pair.size())));
+            queryParams->emplace_back(name, value);
+        }
+        return *queryParams;
+    }
+
+    // plus is a space, an invalid escape is kept as it is
+    static char *decodeQueryComponent(std::string_view encoded, char *decoded)
+    {
+        for (size_t i = 0; i < encoded.size(); i++)
+        {
+            int high = encoded[i] == '%' && i + 2 < encoded.size() ? RequestParser::hexValue(encoded[i + 1]) : -1;
+            int low = high >= 0 ? RequestParser::hexValue(encoded[i + 2]) : -1;
+            if (low >= 0)
+            {
+                *decoded++ = static_cast<char>(high * 16 + low);
+                i += 2;
+            }
+            else
+                *decoded++ = encoded[i] == '+' ? ' ' : encoded[i];
+        }
+        return decoded;
+    }
+
+    const std::string_view *findHeader(std::string_view name) const
+    {
+        return headers.find(name);
+    }
+    const std::string_view *findHeader(HeaderName name) const
+    {
+        return headers.find(name);
+    }
+
+    // Builds the request from the header lines the parser found in received. The header
+    // is copied once out of the connection buffer, which is reused for the next requests.
+    // Only the percent-encoded path and folded lines are rewritten in place, everything
+    // else is just pointed to.
+    void parseHeader(std::string_view received, const RequestParser &parser)
+    {
+        const auto &lines = parser.getLines();
+        size_t begin = parser.getHeaderBegin();
+        header = std::make_unique_for_overwrite<char[]>(parser.getHeaderEnd() - begin);
+        received.copy(header.get(), parser.getHeaderEnd() - begin, begin);
+        // the offsets of the lines count from the start of received
+        char *base = header.get() - begin;
+
+        if (lines.empty())
+        {
+            malformed = true;
+            return;
+        }
+        char *position = base + lines.front().begin;
+        char *lineEnd = base + lines.front().end;
+        // save header in unparsed form only for TRACE requests
+        if (std::string_view(position, lineEnd - position).starts_with("TRACE "))
+            unparsedHeader.assign(position, base + lines.back().end + crlf.size());
+
+        parseRequestLine(position, lineEnd);
+        if (!malformed)
+            parseFields(base, std::span(lines).subspan(1));
+    }
+
+    // METHOD SP request-target SP HTTP-version
+    void parseRequestLine(char *begin, char *end)
+    {
+        std::string_view line(begin, end - begin);
+        size_t methodEnd = line.find(' ');
+        size_t targetEnd = methodEnd == std::string_view::npos ? methodEnd : line.find(' ', methodEnd + 1);
+        if (targetEnd == std::string_view::npos || line.find(' ', targetEnd + 1) != std::string_view::npos)
+        {
+            DEBUG << "malformed request - request line is not three words";
+            malformed = true;
+            return;
+        }
+
+        auto parsedMethod = parseMethod(line.substr(0, methodEnd));
+        httpVersion = line.substr(targetEnd + 1);
+        if (!parsedMethod || !httpVersion.starts_with("HTTP/"))
+        {
+            DEBUG << "malformed request - bad method or version";
+            malformed = true;
+            return;
+        }
+        method = *parsedMethod;
+        setUri(begin + methodEnd + 1, begin + targetEnd);
+    }
+
+    void setUri(char *begin, char *end)
     {
+        std::string_view uri(begin, end - begin);
         // special case allowed only for OPTIONS requests
         if (method == Method::options && uri == "*")
         {
@@ -93,40 +466,65 @@ private:
             return;
         }
 
-        size_t index = 0;
-        while(((index = uri.find('%', index)) != std::string::npos))
+        // absolute form, scheme and authority are skipped
+        if (!uri.starts_with('/'))
         {
-            if (index > uri.size() - 3)
+            size_t authority = uri.find("://");
+            size_t path = authority == std::string_view::npos ? authority : uri.find('/', authority + 3);
+            if (path == std::string_view::npos)
             {
                 malformed = true;
                 return;
             }
-            uri.replace(index, 3, std::string(1, static_cast<char>(stoi(uri.substr(index + 1, 2), 0, 16))));
+            begin += path;
+            uri.remove_prefix(path);
         }
-        
-        static const std::regex uriRegex{"(.*:\\/\\/[^\\/]*)?(/[^\\?#]*)(\\?([^#]*))?(#(.*))?"};
-        std::smatch match;
-        if (std::regex_match(uri, match, uriRegex))
+        uri = uri.substr(0, uri.find('#'));
+        size_t queryStart = std::min(uri.find('?'), uri.size());
+        if (queryStart < uri.size())
+            query = uri.substr(queryStart + 1);
+
+        // decoded in one pass over itself, it can only get shorter
+        char *pathEnd = begin + queryStart;
+        char *decoded = begin;
+        for (char *encoded = begin; encoded < pathEnd; encoded++)
         {
-            uriBase = match.str(2);
-            if (uriBase.back() == '/')
-                uriBase.pop_back();
-            query = match.str(4);
-            part = match.str(6);
+            if (*encoded != '%')
+            {
+                *decoded++ = *encoded;
+                continue;
+            }
+            int high = pathEnd - encoded > 2 ? RequestParser::hexValue(encoded[1]) : -1;
+            int low = high >= 0 ? RequestParser::hexValue(encoded[2]) : -1;
+            if (low < 0)
+            {
+                malformed = true;
+                return;
+            }
+            *decoded++ = static_cast<char>(high * 16 + low);
+            encoded += 2;
         }
-        else
-            malformed = true;
+        uriBase = std::string_view(begin, decoded - begin);
+        if (uriBase.ends_with('/'))
+            uriBase.remove_suffix(1);
     }
 
-    inline static const std::unordered_map<std::string, Method> toMethod = {
-        {"GET", get},
-        {"HEAD", head},
-        {"POST", post},
-        {"PUT", put},
-        {"DELETE", delet},
-        {"OPTIONS", options},
-        {"TRACE", trace}
-    };
+    static std::optional<Method> parseMethod(std::string_view name)
+    {
+        static constexpr std::pair<std::string_view, Method> methods[] = {
+            {"GET", get},
+            {"HEAD", head},
+            {"POST", post},
+            {"PUT", put},
+            {"DELETE", delet},
+            {"OPTIONS", options},
+            {"TRACE", trace}
+        };
+        for (auto &[string, value] : methods)
+            if (string == name)
+                return value;
+        return {};
+    }
     inline static const std::unordered_map<Method, std::string> methodToString {
         {get, "GET"},
         {head, "HEAD"},
@@ -135,187 +533,168 @@ private:
         {delet, "DELETE"}
     };
 
-    void parseRequestLine(const std::string& line)
+    // Field lines (name ":" OWS value OWS CRLF), the offsets of the lines count from base.
+    void parseFields(char *base, std::span<const RequestParser::Line> lines)
     {
-        static const std::regex startLineRegex{"([^ ]+) ([^ ]+) ([^ ]+)"};
-        std::smatch match;
-        if (std::regex_match(line, match, startLineRegex))
+        lastValue = nullptr;
+        // lastValue stays valid
+        headers.reserve(headers.size() + lines.size());
+        for (auto &line : lines)
+            parseField(base + line.begin, base + line.end, line.colon == RequestParser::npos ? nullptr : base + line.colon);
+    }
+
+    // A line starting with whitespace continues the previous value, the line
+    // break is replaced with spaces.
+    void parseField(char *begin, char *end, char *colon)
+    {
+        if (malformed)
+            return;
+        std::string_view line(begin, end - begin);
+        if (line.starts_with(' ') || line.starts_with('\t'))
         {
-            try {
-                method = toMethod.at(match.str(1));
-            } catch (std::out_of_range &e) {
-                DEBUG << "malformed request - bad method";
+            if (!lastValue)
+            {
                 malformed = true;
+                return;
+            }
+            std::string_view &value = *lastValue;
+            std::string_view continuation = trim(line);
+            if (value.empty())
+                value = continuation;
+            else if (std::string *joined = findJoined(value); joined && !continuation.empty())
+                value = joined->append(" ").append(continuation);
+            else if (!continuation.empty())
+            {
+                // the views point into the header, which this request owns
+                std::fill(const_cast<char *>(value.data() + value.size()), const_cast<char *>(continuation.data()), ' ');
+                value = std::string_view(value.data(), continuation.data() + continuation.size() - value.data());
             }
-            setUri(match.str(2));
-            httpVersion = match.str(3);
         }
-        else
+        else if (!line.empty())
         {
-            DEBUG << "malformed request - first line regex does not match";
-            malformed = true;
+            std::string_view name(begin, colon ? colon - begin : line.size());
+            // no whitespace is allowed between the name and the colon
+            if (!colon || name.empty() || name.find_first_of(" \t") != std::string_view::npos)
+            {
+                malformed = true;
+                return;
+            }
+            std::string_view value = trim(std::string_view(colon + 1, end - colon - 1));
+            auto [field, added] = headers.emplace(name, value);
+            if (!added)
+                joinValue(*field, value, HeaderNames::equalsIgnoreCase(name, "Cookie") ? "; " : ", ");
+            lastValue = field;
         }
     }
 
-    inline static constexpr size_t invalidIndex = -1;
+    // a header sent more than once is seen as one with the values joined
+    void joinValue(std::string_view &field, std::string_view value, std::string_view separator)
+    {
+        std::string *joined = findJoined(field);
+        if (!joined)
+            joined = &extraStorage.emplace_back(field);
+        field = joined->append(separator).append(value);
+    }
 
-    static Coroutine<void> readFor(TcpClient &client, std::string &buffer, const size_t length)
+    // the joined value a field points to, nullptr if it points into the received header
+    std::string *findJoined(std::string_view field)
     {
-        while (buffer.size() < length)
-        {
-            auto readCoroutine = client.receive();
-            iterative_co_await(readCoroutine);
-            buffer += readCoroutine.value();
-        }
+        for (auto it = extraStorage.rbegin(); it != extraStorage.rend(); it++)
+            if (it->data() == field.data())
+                return &*it;
+        return nullptr;
     }
 
-    // returns the position of start of the end string or -1 if maxLength is exceeded
-    static Coroutine<size_t> readUntil(TcpClient &client, std::string &buffer, const std::string &end, size_t maxLength)
+    static Coroutine<void> readFor(TcpClient &client, ReceiveBuffer &buffer, const size_t length)
     {
-        size_t i;
-        while (((i = buffer.find(end, i))) == std::string::npos)
+        while (buffer.size() < length)
         {
-            i = buffer.size();
-            if (buffer.size() > maxLength)
-            {
-                co_return -1;
-            }
-            auto readCoroutine = client.receive();
-            iterative_co_await(readCoroutine);
-            buffer += readCoroutine.value();
+            co_await client.receive(buffer);
         }
-        co_return i;
     }
 
-    size_t getContentLength()
+    // receives until the parser has found the end of the header block
+    static Coroutine<RequestParser::Status> readHeader(TcpClient &client, ReceiveBuffer &buffer, RequestParser &parser, size_t maxLength)
     {
-        try { 
-            return static_cast<size_t>(std::stoi(getHeader("Content-Length")));
-        } catch (const std::invalid_argument &e) {
-            malformed = true;
-            return 0;
-        }
+        RequestParser::Status status;
+        while ((status = parser.scanHeader(buffer.view(), maxLength)) == RequestParser::Status::incomplete)
+            co_await client.receive(buffer);
+        co_return status;
     }
 
-    void parseHeaders(const std::vector<std::string> &headerLines, size_t index = 0)
+    size_t getContentLength()
     {
-        std::string lastHeader;
-        for (size_t i = index; i < headerLines.size(); i++)
+        size_t length;
+        if (!parseNumber(getHeader(HeaderName::contentLength), length))
         {
-            const std::string &line = headerLines[i];
-            if (line[0] == '\t' || line[0] == ' ')
-                rawHeaders[lastHeader] += line;
-            else
-            {
-                size_t splitIndex = line.find(':');
-                if (splitIndex != std::string::npos)
-                {
-                    lastHeader = line.substr(0, splitIndex);
-                    rawHeaders[lastHeader] += line.substr(splitIndex + 1) + ' ';
-                }
-                else
-                {
-                    malformed = true;
-                    return;
-                }
-            }
+            malformed = true;
+            return 0;
         }
-
-        for (auto &[key, value] : rawHeaders)
-            value = removeWhitespaces(std::move(value));
+        return length;
     }
 
-    static Coroutine<HttpRequest> fetchRequest(TcpClient &tcpClient, std::string &buffer)
+    static Coroutine<HttpRequest> fetchRequest(TcpClient &tcpClient, ReceiveBuffer &buffer, RequestParser &parser, const Timeouts &timeouts)
     {
         HttpRequest request;
 
-        auto readCoroutine = readUntil(tcpClient, buffer, crlf2, maxHeaderLength); 
-        iterative_co_await(readCoroutine);
-        size_t headerEnd = readCoroutine.value();
+        if (buffer.empty())
+        {
+            tcpClient.setTimeout(timeouts.idle);
+            co_await tcpClient.receive(buffer);
+        }
+        tcpClient.setTimeout(timeouts.headerRead);
 
-        if (headerEnd == invalidIndex)
+        parser.startHeader(true);
+        if (co_await readHeader(tcpClient, buffer, parser, maxHeaderLength) != RequestParser::Status::complete)
         {
             request.malformed = true;
             co_return request;
         }
 
         DEBUG << "header fetched";
-        std::string header = buffer.substr(0, headerEnd + crlf.size());
-        buffer = buffer.erase(0 , headerEnd + crlf2.size());
-        
-        DEBUG << header;
-
-        std::vector<std::string> headerLines = split(header);
-
-        request.parseRequestLine(headerLines[0]);
-        if (request.malformed)
-            co_return request;
-
-        // save header in unparsed form only for TRACE requests
-        if (request.getMethod() == trace)
-            request.unparsedHeader = header;
-        
-        request.parseHeaders(headerLines, 1);
+        DEBUG << buffer.view().substr(0, parser.getHeaderEnd());
+        request.parseHeader(buffer.view(), parser);
+        buffer.consume(parser.getHeaderEnd());
         if (request.malformed)
             co_return request;
 
         if (request.method != head && request.method != get)
         {
-            if (request.hasHeader("Expect"))
+            tcpClient.setTimeout(timeouts.bodyRead);
+            if (request.hasHeader(HeaderName::expect))
             {
-                if (request.hasHeader("Content-Length") && request.getContentLength() > maxBodyLength)
+                if (request.hasHeader(HeaderName::contentLength) && request.getContentLength() > maxBodyLength)
                 {
                     request.bodyNotFetched = true;
-                    co_return;
+                    co_return request;
                 }
                 else // if (buffer.empty())
-                    tcpClient.send("HTTP/1.1 100 Continue" + crlf2);
+                    co_await tcpClient.send("HTTP/1.1 100 Continue" + crlf2);
             }
-            if (request.hasHeader("Transfer-Encoding") && request.getHeader("Transfer-Encoding") != "identity")
+            if (request.hasHeader(HeaderName::transferEncoding) && request.getHeader(HeaderName::transferEncoding) != "identity")
             {
-                // chunked encoding
-                while (true) // chunks
+                // chunked encoding, the chunks are decoded as they arrive
+                parser.startChunkedBody();
+                RequestParser::Status status;
+                while ((status = parser.decodeChunks(buffer, request.body, maxBodyLength)) == RequestParser::Status::incomplete)
+                    co_await tcpClient.receive(buffer);
+                if (status == RequestParser::Status::tooLarge)
+                {
+                    request.bodyNotFetched = true;
+                    co_return request;
+                }
+                parser.startHeader(false);
+                if (status != RequestParser::Status::complete
+                    || co_await readHeader(tcpClient, buffer, parser, maxHeaderLength) != RequestParser::Status::complete)
                 {
-                    if (request.body.size() > maxBodyLength)
-                    {
-                        request.bodyNotFetched = true;
-                        co_return request;
-                    }
-                    auto rc = readUntil(tcpClient, buffer, crlf, maxBodyLength);
-                    iterative_co_await(rc);
-                    size_t index = rc.value();
-                    if (index == invalidIndex)
-                    {
-                        request.malformed = true;
-                        co_return request;
-                    }
-                    size_t chunkLength;
-                    try {
-                        chunkLength = stoul(buffer.substr(0, index), 0, 16);
-                    } catch (const std::invalid_argument &e) {
-                        request.malformed = true;
-                        co_return request;
-                    }
-                    if (chunkLength == 0)
-                    {
-                        buffer.erase(0, index);
-                        break;
-                    }
-                    else
-                        buffer.erase(0, index + crlf.size());
-                    auto rc2 = readFor(tcpClient, buffer, chunkLength + crlf.size());
-                    iterative_co_await(rc2);
-                    request.body += buffer.substr(0, chunkLength);
-                    buffer.erase(0, chunkLength + crlf.size());
+                    request.malformed = true;
+                    co_return request;
                 }
-                auto readCoroutine = readUntil(tcpClient, buffer, crlf2, maxHeaderLength); 
-                iterative_co_await(readCoroutine);
-                size_t trailerEnd = readCoroutine.value();
-                std::string trailer = buffer.substr(0, trailerEnd + crlf.size());
-                buffer = buffer.erase(0 , trailerEnd + crlf2.size());
-                request.parseHeaders(split(trailer));
+                std::string &trailer = request.extraStorage.emplace_back(buffer.view().substr(0, parser.getHeaderEnd()));
+                buffer.consume(parser.getHeaderEnd());
+                request.parseFields(trailer.data(), parser.getLines());
             }
-            else if (request.hasHeader("Content-Length"))
+            else if (request.hasHeader(HeaderName::contentLength))
             {
                 size_t bodyLength = request.getContentLength(); 
 
@@ -325,60 +704,37 @@ private:
                     co_return request;
                 }
 
-                auto rc = readFor(tcpClient, buffer, bodyLength);
-                iterative_co_await(rc);
+                co_await readFor(tcpClient, buffer, bodyLength);
 
-                request.body = buffer.substr(0, bodyLength);
-                buffer.erase(0, bodyLength);
+                request.body.assign(buffer.view().substr(0, bodyLength));
+                buffer.consume(bodyLength);
 
                 DEBUG << "body fetched:" << request.body;
             }
         }
 
-        if (request.rawHeaders.find("Content-type") == request.rawHeaders.end())
-            request.rawHeaders.emplace("Content-type", noContentTypeString);
-
-        if (request.hasHeader("Cookie"))
-        {
-            static std::regex cookieRegex("([a-zA-Z0-9!#$%^&*'~\\-._+`|]*)=(.*?)($|;|,(?! ))");
-            auto begin = std::sregex_iterator(request.getHeader("Cookie").begin(), request.getHeader("Cookie").end(), cookieRegex);
-            auto end = std::sregex_iterator();
-            for (std::sregex_iterator it = begin; it != end; it++)
-                request.cookies[(*it)[1]] = (*it)[2];
-        }
-
         co_return request;
     }
 
-    static std::vector<std::string> split(const std::string &string, const std::string& delim = crlf)
+    static std::string_view trim(std::string_view string)
     {
-        std::vector<std::string> vector;
-        size_t index = 0;
-        while (index < string.size())
-        {
-            size_t newIndex = string.find(delim, index);
-            if (newIndex == std::string::npos)
-                newIndex = string.size();
-            if (index != newIndex)
-                vector.push_back(string.substr(index, newIndex - index));
-            index = newIndex + delim.size();
-        }
-        return vector;
+        while (!string.empty() && (string.front() == ' ' || string.front() == '\t'))
+            string.remove_prefix(1);
+        while (!string.empty() && (string.back() == ' ' || string.back() == '\t'))
+            string.remove_suffix(1);
+        return string;
     }
 
-    static std::string removeWhitespaces(std::string &&string)
+    static bool parseNumber(std::string_view string, size_t &number)
     {
-        static const std::regex whitespaces{"[\n\t\r]+"};
-        string = std::regex_replace(string, whitespaces, " ");
-        if (string.back() == ' ')
-            string.pop_back();
-        if (string[0] == ' ')
-            string = string.substr(1);
-        return string;
+        auto [end, error] = std::from_chars(string.data(), string.data() + string.size(), number);
+        return error == std::errc() && end == string.data() + string.size() && !string.empty();
     }
 
     friend class HttpServer;
     friend class RequestHandler;
+    // builds requests straight from a header in the tests and benchmarks
+    friend struct RequestParsing;
 };
 
 #endif
\ No newline at end of file
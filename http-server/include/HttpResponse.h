@@ -2,9 +2,21 @@
 #ifndef HTTPRESPONSE_H_
 #define HTTPRESPONSE_H_
 
+#include <array>
+#include <cstdio>
+#include <ctime>
+#include <memory>
+#include <optional>
+#include <ostream>
+#include <random>
+#include <span>
+#include <streambuf>
+#include <string_view>
 #include <unordered_map>
+#include <vector>
 
 #include "Coroutine.h"
+#include "FileCache.h"
 #include "HttpMessage.h"
 #include "TcpClient.h"
 
@@ -116,22 +128,66 @@ public:
     HttpResponse &setBody(const std::string &body, const std::string &contentType = "text/html", std::vector<std::string> parameters = {"charset=utf-8"})
     {
         this->body = body;
-        rawHeaders["Content-type"] = contentType;
+        bodyLength.reset();
+        fileBody.reset();
+        prepared.reset();
+        std::string &type = rawHeaders[HeaderName::contentType];
+        type = contentType;
         for (auto &parameter : parameters)
-            rawHeaders["Content-type"] += "; " + parameter;
+            type += "; " + parameter;
         return *this;
     }
-    HttpResponse &setJsonBody(const json &jsonBody)
+    // The body is sent from the file (from memory or with sendfile) when the response is sent,
+    // compressed if the file has compressed variants and the request accepts one of them.
+    HttpResponse &setFileBody(std::shared_ptr<const FileCache::File> file, const std::string &contentType, std::vector<std::string> parameters = {"charset=utf-8"})
     {
-        setBody(jsonBody.dump(), "application/json");
+        setBody("", contentType, std::move(parameters));
+        fileBody = std::move(file);
         return *this;
     }
+    // HEAD requests run the GET handler but get no body, a handler can check this
+    // and give only the length of the body it would send, with setBodyLength
+    bool isBodyNeeded() const
+    {
+        return request.getMethod() != HttpRequest::Method::head;
+    }
+    // the Content-Length of a body which is not sent, ignored when the body is needed
+    HttpResponse &setBodyLength(size_t length, const std::string &contentType = "text/html", std::vector<std::string> parameters = {"charset=utf-8"})
+    {
+        setBody("", contentType, std::move(parameters));
+        bodyLength = length;
+        return *this;
+    }
+    // for HEAD requests the JSON is only measured, not kept
+    HttpResponse &setJsonBody(const json &jsonBody)
+    {
+        if (isBodyNeeded())
+            return setBody(jsonBody.dump(), "application/json");
+        CountingBuffer counter;
+        std::ostream stream(&counter);
+        stream << jsonBody;
+        return setBodyLength(counter.count, "application/json");
+    }
+    // Sets a strong entity tag, given without quotes. When the client already has
+    // this version the response becomes 304 Not Modified and is finished, so the
+    // handler can skip making the body:
+    //     if (response.setETag(std::to_string(version)))
+    //         return;
+    bool setETag(const std::string &tag)
+    {
+        std::string etag = '"' + tag + '"';
+        bool notModified = isNotModified(etag, 0);
+        rawHeaders[HeaderName::etag] = std::move(etag);
+        if (notModified)
+            setStatus(Not_Modified).send();
+        return notModified;
+    }
     HttpResponse &setCookie(const std::string &name, const std::string &value, const std::string &expirationDate = "", const std::string &path = "/")
     {
         std::string cookie = name + "=" + value + "; path=" + path;
         if (!expirationDate.empty())
             cookie.append("; Expires=" + expirationDate);
-        setHeader("Set-Cookie", cookie);
+        rawHeaders[HeaderName::setCookie] = cookie;
         return *this;
     }
     HttpResponse &closeConnection()
@@ -151,37 +207,339 @@ public:
         done = true;
     }
 
+    // the Connection header of the response, or of the request if the response has none
+    bool isPersistentConnection() const
+    {
+        std::string_view connection = getConnection();
+        return !connection.empty() && connection != "close";
+    }
+
 private:
-    HttpResponse(HttpRequest &request, std::unordered_map<std::string, std::string> defaultHeaders = {}, Status status = OK) : HttpMessage(std::move(defaultHeaders)), request(request), status(status) {}
+    // counts the bytes written to it instead of keeping them
+    struct CountingBuffer : std::streambuf
+    {
+        size_t count = 0;
+        int_type overflow(int_type c) override
+        {
+            count += c != traits_type::eof();
+            return traits_type::not_eof(c);
+        }
+        std::streamsize xsputn(const char *, std::streamsize length) override
+        {
+            count += static_cast<size_t>(length);
+            return length;
+        }
+    };
+
+    // A whole response rendered once and sent as it is, only the Date and
+    // Connection headers are added to it for each request.
+    struct Prepared
+    {
+        std::shared_ptr<const FileCache::File> file;
+        FileCache::Encoding encoding;
+        // status line and headers, without the empty line
+        std::string head;
+        std::string notModifiedHead;
+    };
+
+    static std::shared_ptr<const Prepared> prepare(std::shared_ptr<const FileCache::File> file, FileCache::Encoding encoding, const std::string &contentType, HeaderMap<std::string> headers)
+    {
+        setValidatorHeaders(headers, *file, encoding);
+        std::string notModifiedHead = renderHead(Not_Modified, headers);
+        headers[HeaderName::contentType] = contentType + "; charset=utf-8";
+        setContentHeaders(headers, *file, encoding);
+        std::string head = renderHead(OK, headers);
+        return std::make_shared<const Prepared>(Prepared{std::move(file), encoding, std::move(head), std::move(notModifiedHead)});
+    }
+
+    // conditional GET, If-Modified-Since counts only without If-None-Match
+    bool isNotModified(std::string_view etag, std::time_t modified) const
+    {
+        auto method = request.getMethod();
+        if (method != HttpRequest::Method::get && method != HttpRequest::Method::head)
+            return false;
+        if (request.hasHeader(HeaderName::ifNoneMatch))
+            return request.matchesETag(etag);
+        return modified && request.isNotModifiedSince(modified);
+    }
+
+    static void setValidatorHeaders(HeaderMap<std::string> &headers, const FileCache::File &file, FileCache::Encoding encoding)
+    {
+        headers[HeaderName::etag] = file.etag(encoding);
+        headers[HeaderName::lastModified] = file.lastModified();
+        // caches must not give a compressed variant to clients which did not ask for it
+        if (file.isCompressed())
+            headers[HeaderName::vary] = "Accept-Encoding";
+    }
+
+    // the variant of the file to send, gzip is preferred to deflate
+    FileCache::Encoding chooseEncoding(const FileCache::File &file) const
+    {
+        if (!file.isCompressed())
+            return FileCache::Encoding::identity;
+        if (request.acceptsEncoding("gzip"))
+            return FileCache::Encoding::gzip;
+        if (request.acceptsEncoding("deflate"))
+            return FileCache::Encoding::deflate;
+        return FileCache::Encoding::identity;
+    }
+
+    static void setContentHeaders(HeaderMap<std::string> &headers, const FileCache::File &file, FileCache::Encoding encoding)
+    {
+        headers[HeaderName::acceptRanges] = "bytes";
+        if (encoding == FileCache::Encoding::gzip)
+            headers[HeaderName::contentEncoding] = "gzip";
+        else if (encoding == FileCache::Encoding::deflate)
+            headers[HeaderName::contentEncoding] = "deflate";
+        headers[HeaderName::contentLength] = std::to_string(file.length(encoding));
+    }
+
+    // 206 for a satisfiable Range of a GET, 416 for an unsatisfiable one, otherwise 200
+    Status selectRanges(const FileCache::File &file, FileCache::Encoding encoding, std::vector<HttpRequest::ByteRange> &ranges) const
+    {
+        if (request.getMethod() != HttpRequest::Method::get)
+            return OK;
+        auto requested = request.getRanges(file.length(encoding));
+        if (!requested || !isRangeCurrent(file, encoding))
+            return OK;
+        if (requested->empty())
+            return Requested_range_not_satisfiable;
+        ranges = std::move(*requested);
+        return Partial_Content;
+    }
+
+    // with If-Range the ranges are sent only if the version did not change, otherwise the whole file
+    bool isRangeCurrent(const FileCache::File &file, FileCache::Encoding encoding) const
+    {
+        if (!request.hasHeader(HeaderName::ifRange))
+            return true;
+        std::string_view validator = request.getHeader(HeaderName::ifRange);
+        // strong comparison, a weak W/"..." tag never matches
+        if (validator.starts_with('"'))
+            return validator == file.etag(encoding);
+        return validator == file.lastModified();
+    }
+
+    HttpResponse &setPrepared(std::shared_ptr<const Prepared> prepared)
+    {
+        this->prepared = std::move(prepared);
+        return *this;
+    }
+
+    static std::string renderHead(Status status, const HeaderMap<std::string> &headers)
+    {
+        std::string head = "HTTP/1.1 " + statusToLine.at(status) + crlf;
+        headers.forEach([&head](std::string_view name, const std::string &value) {
+            head.append(name).append(": ").append(value).append(crlf);
+        });
+        return head;
+    }
+
+    // the Date header line, formatted again at most once a second by each thread
+    static std::string_view dateLine()
+    {
+        static thread_local char line[64];
+        static thread_local size_t length = 0;
+        static thread_local std::time_t formatted = -1;
+        std::time_t now = std::time(nullptr);
+        if (now != formatted)
+        {
+            std::tm time;
+            gmtime_r(&now, &time);
+            length = std::strftime(line, sizeof(line), "Date: %a, %d %b %Y %H:%M:%S GMT\r\n", &time);
+            formatted = now;
+        }
+        return std::string_view(line, length);
+    }
+
+    std::string_view getConnection() const
+    {
+        if (auto connection = rawHeaders.find(HeaderName::connection))
+            return *connection;
+        if (request.hasHeader(HeaderName::connection))
+            return request.getHeader(HeaderName::connection);
+        return {};
+    }
+
+    HttpResponse(HttpRequest &request, const HeaderMap<std::string> &defaultHeaders = {}, Status status = OK) : request(request), status(status)
+    {
+        // room for the content and connection headers added to the defaults
+        rawHeaders.reserve(defaultHeaders.size() + 4);
+        rawHeaders = defaultHeaders;
+    }
 
     HttpRequest &request;
     Status status;
 
     bool done = false;
+    // the length of the body a HEAD response leaves out, when there is no body to measure
+    std::optional<size_t> bodyLength;
+    std::shared_ptr<const FileCache::File> fileBody;
+    std::shared_ptr<const Prepared> prepared;
 
     friend class RequestHandler;
     bool isReady() { return done; }
 
     Coroutine<void> send(TcpClient &tcpClient)
     {
-        if (!body.empty())
-            rawHeaders["Content-Length"] = std::to_string(body.size());
+        bool withBody = request.getMethod() != HttpRequest::Method::head;
+        if (prepared)
+        {
+            co_await sendPrepared(tcpClient, withBody);
+            co_return;
+        }
+
+        auto encoding = fileBody ? chooseEncoding(*fileBody) : FileCache::Encoding::identity;
+        std::vector<HttpRequest::ByteRange> ranges;
+        if (fileBody)
+        {
+            setValidatorHeaders(rawHeaders, *fileBody, encoding);
+            if (status == OK && isNotModified(fileBody->etag(encoding), fileBody->modified))
+                status = Not_Modified;
+            else if (status == OK)
+                status = selectRanges(*fileBody, encoding, ranges);
+        }
+
+        if (request.hasHeader(HeaderName::connection) && !rawHeaders.contains(HeaderName::connection))
+            rawHeaders[HeaderName::connection] = request.getHeader(HeaderName::connection);
+
+        // a 304 has only the headers of the 200 which describe the version, no body
+        if (status == Not_Modified)
+        {
+            withBody = false;
+            rawHeaders.erase(HeaderName::contentType);
+        }
+        else if (fileBody && status == Requested_range_not_satisfiable)
+        {
+            withBody = false;
+            rawHeaders.erase(HeaderName::contentType);
+            rawHeaders[HeaderName::contentRange] = "bytes */" + std::to_string(fileBody->length(encoding));
+            rawHeaders[HeaderName::contentLength] = "0";
+        }
+        else if (!ranges.empty())
+        {
+            co_await sendRanges(tcpClient, encoding, ranges);
+            co_return;
+        }
+        else if (fileBody)
+            setContentHeaders(rawHeaders, *fileBody, encoding);
+        else if (!body.empty())
+            rawHeaders[HeaderName::contentLength] = std::to_string(body.size());
+        else if (bodyLength && !withBody)
+            rawHeaders[HeaderName::contentLength] = std::to_string(*bodyLength);
 
-        if (request.hasHeader("Connection") && !hasHeader("Connection"))
-            rawHeaders["Connection"] = request.getHeader("Connection");
+        std::string header = renderHead(status, rawHeaders);
+        header += dateLine();
+        header += crlf;
 
-        std::string message = "HTTP/1.1 " + statusToLine.at(status) + crlf;
+        // the body is sent from where it is, never copied after the header
+        // a loaded file goes right after the header, a large one is streamed after it
+        std::array<std::string_view, 2> segments = {header, fileBody ? fileBody->content(encoding) : body};
+        bool withFile = withBody && fileBody && !fileBody->isLoaded() && fileBody->size > 0;
+        size_t count = withBody ? segments.size() : 1;
+        co_await tcpClient.send(std::span<const std::string_view>(segments.data(), count), withFile);
+        if (withFile)
+            co_await tcpClient.sendFile(fileBody->fd, 0, fileBody->size);
+    }
+
+    // a fixed boundary may occur in a file, a random one drawn per response practically never
+    static std::string randomBoundary()
+    {
+        static thread_local std::mt19937_64 generator = [] {
+            std::random_device device;
+            std::seed_seq seed{device(), device(), device(), device()};
+            return std::mt19937_64(seed);
+        }();
+        char boundary[44];
+        unsigned long long high = generator(), low = generator();
+        std::snprintf(boundary, sizeof(boundary), "byteranges_%016llx%016llx", high, low);
+        return boundary;
+    }
 
-        for (auto &[header, value] : rawHeaders)
-            message += header + ": " + value + crlf;
+    // One range is sent as the body, several as the parts of a multipart/byteranges body.
+    // Only the requested bytes are sent, from memory or with sendfile.
+    Coroutine<void> sendRanges(TcpClient &tcpClient, FileCache::Encoding encoding, const std::vector<HttpRequest::ByteRange> &ranges)
+    {
+        const FileCache::File &file = *fileBody;
+        size_t length = file.length(encoding);
+        setContentHeaders(rawHeaders, file, encoding);
+        auto contentRange = [length](const HttpRequest::ByteRange &range) {
+            return "bytes " + std::to_string(range.first) + '-' + std::to_string(range.last) + '/' + std::to_string(length);
+        };
+
+        // the headers of the parts and the closing boundary, only for several ranges
+        std::vector<std::string> partHeaders;
+        size_t bodyLength = 0;
+        if (ranges.size() == 1)
+        {
+            rawHeaders[HeaderName::contentRange] = contentRange(ranges.front());
+            bodyLength = ranges.front().last - ranges.front().first + 1;
+        }
+        else
+        {
+            std::string boundary = randomBoundary();
+            auto type = rawHeaders.find(HeaderName::contentType);
+            std::string partType = type ? "Content-Type: " + *type + crlf : "";
+            for (auto &range : ranges)
+            {
+                partHeaders.push_back(crlf + "--" + boundary + crlf + partType + "Content-Range: " + contentRange(range) + crlf2);
+                bodyLength += partHeaders.back().size() + range.last - range.first + 1;
+            }
+            partHeaders.push_back(crlf + "--" + boundary + "--" + crlf);
+            bodyLength += partHeaders.back().size();
+            rawHeaders[HeaderName::contentType] = "multipart/byteranges; boundary=" + boundary;
+        }
+        rawHeaders[HeaderName::contentLength] = std::to_string(bodyLength);
 
-        message += crlf;
+        std::string header = renderHead(status, rawHeaders);
+        header += dateLine();
+        header += crlf;
 
-        if (request.getMethod() != HttpRequest::Method::head)
-            message += body;
+        // ranges of loaded files are gathered into as few sendmsg calls as possible
+        std::vector<std::string_view> segments = {header};
+        for (size_t i = 0; i < ranges.size(); i++)
+        {
+            if (!partHeaders.empty())
+                segments.push_back(partHeaders[i]);
+            size_t rangeLength = ranges[i].last - ranges[i].first + 1;
+            if (file.isLoaded())
+                segments.push_back(file.content(encoding).substr(ranges[i].first, rangeLength));
+            else
+            {
+                co_await tcpClient.send(segments, true);
+                segments.clear();
+                co_await tcpClient.sendFile(file.fd, static_cast<off_t>(ranges[i].first), rangeLength);
+            }
+        }
+        if (!partHeaders.empty())
+            segments.push_back(partHeaders.back());
+        co_await tcpClient.send(segments);
+    }
 
-        auto sendCoroutine = tcpClient.send(message);
-        iterative_co_await(sendCoroutine);
+    // nothing is rendered or allocated, a loaded file goes out in a single sendmsg
+    Coroutine<void> sendPrepared(TcpClient &tcpClient, bool withBody)
+    {
+        const FileCache::File &file = *prepared->file;
+        bool notModified = isNotModified(file.etag(prepared->encoding), file.modified);
+        withBody = withBody && !notModified;
+        std::string_view connection = getConnection();
+        std::array<std::string_view, 7> segments;
+        size_t count = 0;
+        segments[count++] = notModified ? prepared->notModifiedHead : prepared->head;
+        segments[count++] = dateLine();
+        if (!connection.empty())
+        {
+            segments[count++] = "Connection: ";
+            segments[count++] = connection;
+            segments[count++] = crlf;
+        }
+        segments[count++] = crlf;
+        if (withBody)
+            segments[count++] = file.content(prepared->encoding);
+        bool withFile = withBody && !file.isLoaded() && file.size > 0;
+        co_await tcpClient.send(std::span<const std::string_view>(segments.data(), count), withFile);
+        if (withFile)
+            co_await tcpClient.sendFile(file.fd, 0, file.size);
     }
     friend class HttpServer;
 };
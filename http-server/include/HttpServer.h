@@ -1,9 +1,14 @@
 #ifndef HTTPSERVER_H_
 #define HTTPSERVER_H_
 
+#include <array>
+#include <csignal>
 #include <functional>
-#include <future>
 #include <fstream>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_set>
 #include <utility>
 #include <vector>
 
@@ -16,13 +21,20 @@ using json = nlohmann::json;
 #include "RequestHandler.h"
 #include "TcpServer.h"
 #include "TcpClient.h"
+#include "WorkerPool.h"
 
 class HttpServer
 {
 public:
     HttpServer() = default;
 
-    void setDefaultCallback(RequestHandler::CallbackType &&callback) { defaultCallback = std::move(callback); }
+    // The default callback is also used by the (inline) static directory handler
+    // for missing files, so it should not block for long.
+    void setDefaultCallback(RequestHandler::CallbackType &&callback, bool runInline = false)
+    {
+        defaultCallback = std::move(callback);
+        defaultCallbackInline = runInline;
+    }
 
     template <HttpRequest::Method method, typename... CallbackT>
     void bind(std::string &&path, CallbackT&&... callbacks)
@@ -66,17 +78,51 @@ public:
         {".txt", "text/plain"}
     };
 
+    // static files of these types are also kept compressed with gzip and deflate
+    std::unordered_set<std::string> compressedTypes = {
+        "text/html",
+        "text/javascript",
+        "text/css",
+        "text/plain",
+        "image/x-icon",
+        "application/json"
+    };
+
+    std::string getContentType(const std::filesystem::path &filePath) const
+    {
+        auto it = extensionToType.find(filePath.extension().string());
+        return it != extensionToType.end() ? it->second : "application/octet-stream";
+    }
+
+    // The file is read from the disk on the first request and again whenever it changes.
+    // The whole response is rendered once per version of the file and shared by all routes
+    // bound to the same file, so a request only adds the Date and Connection headers to it.
     void bindStaticFile(std::string &&path, const std::filesystem::path &filePath)
     {
         if (!std::filesystem::is_regular_file(filePath))
             throw std::runtime_error("file " + filePath.string() + " not found");
-        std::string content = file::readAll(filePath);
+        std::string fileName = std::filesystem::absolute(filePath).lexically_normal().string();
         std::string contentType = extensionToType.at(filePath.extension().string());
-        get(std::move(path), [=] (HttpRequest &request, HttpResponse &response) {
-            response.setStatus(200).setBody(content, contentType);
+        auto &staticFile = staticFiles[fileName + ' ' + contentType];
+        if (!staticFile)
+        {
+            bool compress = compressedTypes.count(contentType);
+            staticFile = std::make_shared<StaticFile>(std::move(fileName), std::move(contentType), compress);
+        }
+        get(std::move(path), RequestHandler::runInline, [this, staticFile = staticFile] (HttpRequest &request, HttpResponse &response) {
+            auto prepared = prepareStaticFile(*staticFile, response);
+            if (!prepared)
+                defaultCallback(request, response);
+            // the rare range requests are rendered for each request
+            else if (request.hasHeader(HeaderName::range))
+                response.setStatus(200).setFileBody(prepared->file, staticFile->contentType).send();
+            else
+                response.setPrepared(std::move(prepared)).send();
         });
     }
 
+    // Serves the files under baseDir as they are on the disk at the time of the request,
+    // nothing is read in advance. Files with an unknown extension are sent as application/octet-stream.
     void bindStaticDirectory(const std::string &path, const std::filesystem::path &baseDir)
     {
         if (!std::filesystem::is_directory(baseDir))
@@ -85,29 +131,32 @@ public:
         static const std::string paramName = "path343048903816";
         std::string fullPath = path + ((path.back() == '/') ? "" : "/") + "<" + paramName + ">";
 
-        std::unordered_map<std::string, std::pair<std::string, std::string>> files;
-        for (auto &p : std::filesystem::recursive_directory_iterator(baseDir))
-        {
-            std::filesystem::path path = p.path();
-            DEBUG << path;
-            DEBUG << path.extension().native();
-            if (std::filesystem::is_regular_file(path))
-                files.emplace(path.string(), std::make_pair(file::readAll(path), extensionToType.at(path.extension().string())));
-        }
+        std::filesystem::path base = std::filesystem::absolute(baseDir).lexically_normal();
+        if (!base.has_filename())
+            base = base.parent_path();
 
-        get(std::move(fullPath), [this, baseDir, files] (HttpRequest &request, HttpResponse &response) {
+        get(std::move(fullPath), RequestHandler::runInline, [this, base] (HttpRequest &request, HttpResponse &response) {
 
             std::string pathString = request.getPathParam(paramName);
-            std::filesystem::path path(pathString);
-            std::filesystem::path fullPath = baseDir / path;
-            auto it = files.find(fullPath.string());
-            if (it == files.end())
+            std::filesystem::path fullPath = (base / std::filesystem::path(pathString).relative_path()).lexically_normal();
+            // ".." must not lead out of the base directory
+            auto [baseEnd, pathEnd] = std::mismatch(base.begin(), base.end(), fullPath.begin(), fullPath.end());
+            std::shared_ptr<const FileCache::File> file;
+            std::string contentType = getContentType(fullPath);
+            if (baseEnd == base.end() && pathEnd != fullPath.end())
+                file = fileCache.open(fullPath.string(), compressedTypes.count(contentType));
+            if (!file)
                 defaultCallback(request, response);
             else
-                response.setStatus(200).setBody(it->second.first, it->second.second).send();
+                response.setStatus(200).setFileBody(std::move(file), contentType).send();
         });
     }
 
+    FileCache::Stats getFileCacheStats() const
+    {
+        return fileCache.getStats();
+    }
+
     using ExceptionHandler = std::function<void(const std::exception&, HttpResponse&)>;
 
     void addExceptionHandler(ExceptionHandler &&callback)
@@ -115,30 +164,126 @@ public:
         exceptionHandlers.emplace_back(std::move(callback));
     }
 
+    // Handlers run on a pool of `threads` workers shared by all event loops.
+    // Requests which do not fit into a queue of `queueDepth` jobs are answered
+    // with 503 Service Unavailable. Must be called before listen.
+    void setWorkerPool(size_t threads, size_t queueDepth = WorkerPool::defaultQueueDepth)
+    {
+        workerThreads = threads;
+        workerQueueDepth = queueDepth;
+    }
+
+    WorkerPool::Stats getWorkerPoolStats() const
+    {
+        if (workerPool)
+            return workerPool->getStats();
+        WorkerPool::Stats stats;
+        stats.queueDepth = workerQueueDepth;
+        return stats;
+    }
+
+    // Starts `threads` independent event loops, each with its own SO_REUSEPORT
+    // listening socket and epoll instance. All of them share the handlers,
+    // so no handler may be bound after listen is called.
     [[noreturn]]
-    void listen(int port = 80)
+    void listen(int port = 80, unsigned threads = 1)
     {
-        tcpServer.bind(port);
-        tcpServer.setClientTaskCallback([this](auto client, auto notify) {
-            return clientHandlingTask(std::move(client), std::move(notify));
-        });
-        DEBUG << "Starting server on port" << port;
-        tcpServer.waitForever();
+        threads = std::max(threads, 1u);
+        // a client gone in the middle of a sendfile must end its connection, not the process
+        std::signal(SIGPIPE, SIG_IGN);
+        workerPool = std::make_unique<WorkerPool>(workerThreads, workerQueueDepth);
+        for (unsigned i = 0; i < threads; i++)
+        {
+            auto &tcpServer = tcpServers.emplace_back(std::make_unique<TcpServer>(backend));
+            tcpServer->setMaxEvents(eventBatchSize);
+            tcpServer->setClientTaskCallback([this](auto client, auto notify) {
+                return clientHandlingTask(std::move(client), std::move(notify));
+            });
+            tcpServer->bind(port, threads > 1);
+        }
+        DEBUG << "Starting server on port" << port << "with" << threads << "event loops";
+        for (unsigned i = 1; i < threads; i++)
+            eventLoopThreads.emplace_back([&tcpServer = *tcpServers[i]] { tcpServer.waitForever(); });
+        tcpServers.front()->waitForever();
+    }
+
+    // number of epoll events drained per wakeup of each event loop, must be set before listen
+    void setEventBatchSize(size_t maxEvents)
+    {
+        eventBatchSize = maxEvents;
+    }
+
+    // limits after which the event loops close slow or idle connections
+    void setTimeouts(const HttpMessage::Timeouts &timeouts)
+    {
+        this->timeouts = timeouts;
+    }
+
+    // readiness backend of the event loops (epoll or io_uring), must be set before listen
+    void setBackend(Poller::Backend backend)
+    {
+        this->backend = backend;
+    }
+
+    // sum of the counters of all event loops, each loop publishes them once per wakeup,
+    // so it is only a rough snapshot while the server is running
+    EpollManager::Stats getEventLoopStats() const
+    {
+        EpollManager::Stats total;
+        total.maxEvents = eventBatchSize;
+        for (auto &tcpServer : tcpServers)
+        {
+            auto stats = tcpServer->getStats();
+            total.wakeups += stats.wakeups;
+            total.events += stats.events;
+            total.fullBatches += stats.fullBatches;
+            total.completions += stats.completions;
+            total.systemCalls += stats.systemCalls;
+            total.reaped += stats.reaped;
+            total.spuriousWakeups += stats.spuriousWakeups;
+            total.frameHits += stats.frameHits;
+            total.frameMisses += stats.frameMisses;
+            total.largestBatch = std::max(total.largestBatch, stats.largestBatch);
+        }
+        return total;
     }
 
     void addAccessControllAllowOrigin(const std::string &host)
     {
-        if (defalutHeaders.find(accessControllAllowOrigin) != defalutHeaders.end())
-            defalutHeaders[accessControllAllowOrigin] += ", ";
-        defalutHeaders[accessControllAllowOrigin] += host;
+        std::string &origins = defalutHeaders[HeaderName::accessControlAllowOrigin];
+        if (!origins.empty())
+            origins += ", ";
+        origins += host;
     }
 
 private:
-    TcpServer tcpServer;
+    std::vector<std::unique_ptr<TcpServer>> tcpServers;
+    std::vector<std::thread> eventLoopThreads;
+    size_t eventBatchSize = EpollManager::defaultMaxEvents;
+    Poller::Backend backend = Poller::Backend::epoll;
+    HttpMessage::Timeouts timeouts;
+
+    FileCache fileCache;
 
-    std::unordered_map<std::string, std::string> defalutHeaders;
+    struct StaticFile
+    {
+        const std::string fileName;
+        const std::string contentType;
+        const bool compress;
+        std::mutex mutex;
+        std::shared_ptr<const FileCache::File> file;
+        bool compressed = false;
+        // one for each encoding, rendered when first requested
+        std::array<std::shared_ptr<const HttpResponse::Prepared>, 3> prepared;
+    };
+    // bound files by name and content type, only filled before listen
+    std::unordered_map<std::string, std::shared_ptr<StaticFile>> staticFiles;
 
-    inline static const std::string accessControllAllowOrigin = "Access-Control-Allow-Origin";
+    std::unique_ptr<WorkerPool> workerPool;
+    size_t workerThreads = WorkerPool::defaultThreads;
+    size_t workerQueueDepth = WorkerPool::defaultQueueDepth;
+
+    HeaderMap<std::string> defalutHeaders;
 
     std::unordered_map<HttpRequest::Method, std::vector<RequestHandler>> handlers = {
         {HttpRequest::Method::get, {}},
@@ -150,7 +295,29 @@ private:
 
     std::vector<ExceptionHandler> exceptionHandlers;
 
-    using OptionalCallback = std::optional<RequestHandler::CallbackType>;
+    using OptionalCallback = std::optional<RequestHandler::PreparedCallback>;
+
+    // Rendered again when the cache returns another version of the file, or when the
+    // compressed variants of the file become ready, the identity one then gets Vary.
+    std::shared_ptr<const HttpResponse::Prepared> prepareStaticFile(StaticFile &staticFile, const HttpResponse &response)
+    {
+        auto file = fileCache.open(staticFile.fileName, staticFile.compress);
+        if (!file)
+            return nullptr;
+        bool compressed = file->isCompressed();
+        auto encoding = response.chooseEncoding(*file);
+        std::lock_guard lock(staticFile.mutex);
+        if (staticFile.file != file || staticFile.compressed != compressed)
+        {
+            staticFile.file = file;
+            staticFile.compressed = compressed;
+            staticFile.prepared = {};
+        }
+        auto &prepared = staticFile.prepared[static_cast<size_t>(encoding)];
+        if (!prepared)
+            prepared = HttpResponse::prepare(std::move(file), encoding, staticFile.contentType, defalutHeaders);
+        return prepared;
+    }
 
     OptionalCallback prepareCallbackForMethod(HttpRequest &request, HttpRequest::Method method)
     {
@@ -163,35 +330,35 @@ private:
         return {};
     }
 
-    RequestHandler::CallbackType prepareCallback(HttpRequest &request)
+    RequestHandler::PreparedCallback prepareCallback(HttpRequest &request)
     {
         auto callback = prepareCallbackForMethod(request, request.getMethod());
-        // if there is no matching HEAD handler use
-        // a GET handler (and the body won't be send later)
+        // if there is no matching HEAD handler use a GET handler (the body won't be
+        // sent later, the handler can skip making it if response.isBodyNeeded() is false)
         if (!callback && request.getMethod() == HttpRequest::Method::head)
             callback = prepareCallbackForMethod(request, HttpRequest::Method::get);
         if (!callback)
-            return defaultCallback;
+            return {defaultCallback, defaultCallbackInline};
         else
             return callback.value();
     }
 
-    Coroutine<void> clientHandlingTask(TcpClient&& client, Notify notify)
+    // the task starts only once it is added to the event loop, so it owns the client from the beginning
+    Coroutine<void> clientHandlingTask(TcpClient tcpClient, Notify notify)
     {
         DEBUG << "New client starting";
-        TcpClient tcpClient = std::move(client);
-        co_await std::suspend_always();
 
-        std::string buffer;
+        ReceiveBuffer buffer;
+        RequestParser parser;
 
         bool keepConnection = true;
         try {
             while (keepConnection)
             {
-                auto requestCoroutine = HttpRequest::fetchRequest(tcpClient, buffer);
-                iterative_co_await(requestCoroutine);
+                HttpRequest request = co_await HttpRequest::fetchRequest(tcpClient, buffer, parser, timeouts);
+                // handlers may take as long as they need
+                tcpClient.clearTimeout();
 
-                HttpRequest request = requestCoroutine.value();
                 HttpResponse response(request, defalutHeaders);
                 DEBUG << "received request" << request.getMethod() << request.getUriBase();
 
@@ -205,35 +372,24 @@ private:
                     handleOptions(request, response);
                 else
                 {
-                    auto callback = prepareCallback(request);
-
-                    auto responsePromise = std::async(std::launch::async, [&](Notify notify) {
-                        try {
-                            try {
-                                DEBUG << "launching callback for " << request.getUriBase();
-                                callback(request, response);
-                            } catch (const std::exception &e) {
-                                for (auto &exceptionHandler : exceptionHandlers)
-                                {
-                                    if (response.isReady())
-                                        break;
-                                    exceptionHandler(e, response);
-                                }
-                                if (!response.isReady())
-                                    throw;
-                            }
-                        } catch (const std::exception &e) {
-                            defaultExceptionHandler(e, request, response);
-                        } catch (...) {
-                            fatal500(request, response);
-                            DEBUG << "NOT EVEN DERIVED FROM std::exception";
-                        }
-                    }, notify.createCopy());
-                    co_await std::suspend_always();
-                    responsePromise.wait();
+                    auto [callback, runInline] = prepareCallback(request);
+
+                    if (runInline)
+                        runCallback(callback, request, response);
+                    else
+                    {
+                        bool queued = workerPool->submit([&] {
+                            runCallback(callback, request, response);
+                            notify();
+                        });
+                        if (!queued)
+                            handleOverloaded(response);
+                        else
+                            co_await notify.completion();
+                    }
                 }
-                auto sendCoroutine = response.send(tcpClient);
-                iterative_co_await(sendCoroutine);
+                tcpClient.setTimeout(timeouts.write);
+                co_await response.send(tcpClient);
 
                 keepConnection = response.isPersistentConnection();
             }
@@ -242,18 +398,41 @@ private:
             DEBUG << R"*(Client closed connection despite no "Connection: close")*";
         }
 
-        notify.release();
-
         DEBUG << "connection ending";
         tcpClient.close();
     }
 
+    void runCallback(const RequestHandler::CallbackType &callback, HttpRequest &request, HttpResponse &response)
+    {
+        try {
+            try {
+                DEBUG << "launching callback for " << request.getUriBase();
+                callback(request, response);
+            } catch (const std::exception &e) {
+                for (auto &exceptionHandler : exceptionHandlers)
+                {
+                    if (response.isReady())
+                        break;
+                    exceptionHandler(e, response);
+                }
+                if (!response.isReady())
+                    throw;
+            }
+        } catch (const std::exception &e) {
+            defaultExceptionHandler(e, request, response);
+        } catch (...) {
+            fatal500(request, response);
+            DEBUG << "NOT EVEN DERIVED FROM std::exception";
+        }
+    }
+
     static void default404(HttpRequest &request, HttpResponse &response)
     {
         response.setStatus(404);
         response.setBody("<h1>404</h1> Resource not found <br/> :(");
     }
     RequestHandler::CallbackType defaultCallback = default404;
+    bool defaultCallbackInline = true;
 
     static void defaultExceptionHandler(const std::exception &e, HttpRequest &request, HttpResponse &response)
     {
@@ -283,11 +462,16 @@ private:
         response.setStatus(HttpResponse::Request_Entity_Too_Large).setBody("Entity too large").closeConnection();
     }
 
+    static void handleOverloaded(HttpResponse &response)
+    {
+        response.setStatus(HttpResponse::Service_Unavailable).setBody("Server is overloaded, try again later");
+    }
+
     void handleOptions(HttpRequest &request, HttpResponse &response)
     {
         if (request.getUriBase() == "*")
         {
-            response.setStatus(200).setHeader("Allow", "GET, HEAD, PUT, POST, DELETE");
+            response.setStatus(200).setHeader(HeaderName::allow, "GET, HEAD, PUT, POST, DELETE");
         }
         else
         {
@@ -302,13 +486,13 @@ private:
             else
             {
                 allow.erase(allow.size() - 2);
-                response.setStatus(200).setHeader("Allow", allow);
+                response.setStatus(200).setHeader(HeaderName::allow, allow);
             }
         }
-        if (request.hasHeader("Access-Control-Request-Headers"))
-            response.setHeader("Access-Control-Allow-Headers", request.getHeader("Access-Control-Request-Headers"));
-        if (request.hasHeader("Access-Control-Request-Methods"))
-            response.setHeader("Access-Control-Allow-Methods", request.getHeader("Access-Control-Request-Methods"));
+        if (request.hasHeader(HeaderName::accessControlRequestHeaders))
+            response.setHeader(HeaderName::accessControlAllowHeaders, std::string(request.getHeader(HeaderName::accessControlRequestHeaders)));
+        if (request.hasHeader(HeaderName::accessControlRequestMethod))
+            response.setHeader(HeaderName::accessControlAllowMethods, std::string(request.getHeader(HeaderName::accessControlRequestMethod)));
     }
 
     static void handleTrace(HttpRequest &request, HttpResponse &response)
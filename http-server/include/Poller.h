@@ -0,0 +1,356 @@
+#ifndef POLLER_H
+#define POLLER_H
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <vector>
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+// poll updates are needed to change the events of a socket
+#ifdef IORING_POLL_UPDATE_EVENTS
+#define HTTP_SERVER_HAS_IO_URING 1
+#endif
+#endif
+
+#include "error.h"
+
+// Readiness notification backend of the EpollManager.
+// Events use epoll flags and are reported as epoll_event with the data given to add,
+// the low 32 bits of which have to be the descriptor.
+class Poller
+{
+public:
+    enum class Backend
+    {
+        epoll, io_uring
+    };
+
+    static std::unique_ptr<Poller> create(Backend backend);
+
+    virtual ~Poller() = default;
+
+    virtual void add(int fd, uint32_t events, uint64_t data) = 0;
+    // replaces the events of a descriptor added before with the same data
+    virtual void modify(int fd, uint32_t events, uint64_t data) = 0;
+    // called after the descriptor was closed by its owner
+    virtual void remove(int fd, uint64_t data) = 0;
+    // blocks until at least one event is ready, returns the number of events filled
+    virtual size_t wait(epoll_event *events, size_t maxEvents) = 0;
+
+    // system calls made by the poller itself (not the reads and writes of the sockets)
+    size_t getSystemCalls() const
+    {
+        return systemCalls;
+    }
+
+protected:
+    size_t systemCalls = 0;
+};
+
+class EpollPoller : public Poller
+{
+public:
+    EpollPoller()
+    {
+        epollFileDescriptor = epoll_create1(EPOLL_CLOEXEC);
+        if (epollFileDescriptor == errorCode)
+            error("epoll_create1");
+    }
+
+    ~EpollPoller()
+    {
+        if (epollFileDescriptor != errorCode)
+            close(epollFileDescriptor);
+    }
+
+    void add(int fd, uint32_t events, uint64_t data) override
+    {
+        epoll_event event;
+        event.events = events;
+        event.data.u64 = data;
+        systemCalls++;
+        if (epoll_ctl(epollFileDescriptor, EPOLL_CTL_ADD, fd, &event) == errorCode)
+            error("epoll_ctl");
+    }
+
+    void modify(int fd, uint32_t events, uint64_t data) override
+    {
+        epoll_event event;
+        event.events = events;
+        event.data.u64 = data;
+        systemCalls++;
+        if (epoll_ctl(epollFileDescriptor, EPOLL_CTL_MOD, fd, &event) == errorCode)
+            error("epoll_ctl");
+    }
+
+    // closing the last descriptor of a file removes it from epoll
+    void remove(int fd, uint64_t data) override {}
+
+    size_t wait(epoll_event *events, size_t maxEvents) override
+    {
+        systemCalls++;
+        int code = epoll_wait(epollFileDescriptor, events, static_cast<int>(maxEvents), -1);
+        if (code == errorCode)
+            error("epoll_wait");
+        return static_cast<size_t>(code);
+    }
+
+private:
+    int epollFileDescriptor = -1;
+};
+
+#ifdef HTTP_SERVER_HAS_IO_URING
+
+// Multishot IORING_OP_POLL_ADD requests instead of epoll_ctl. All (re)registrations
+// are queued in the submission ring and sent to the kernel together with the wait,
+// so every wakeup of the event loop costs exactly one io_uring_enter.
+// Only the readiness comes from the ring, the sockets are still accepted, read and
+// written with accept4, recv and sendmsg after a notification, as with epoll.
+// TODO multishot accept, receives into provided buffers and sends batched into the
+// wait need TcpServer and TcpClient to await completions instead of readiness.
+class UringPoller : public Poller
+{
+public:
+    static constexpr unsigned defaultEntries = 1024;
+
+    UringPoller(unsigned entries = defaultEntries)
+    {
+        io_uring_params params;
+        std::memset(&params, 0, sizeof(params));
+        params.flags = IORING_SETUP_CQSIZE;
+        params.cq_entries = entries * 4;
+
+        ringFileDescriptor = static_cast<int>(syscall(__NR_io_uring_setup, entries, &params));
+        if (ringFileDescriptor == errorCode)
+            error("io_uring_setup");
+
+        sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        bool singleMmap = params.features & IORING_FEAT_SINGLE_MMAP;
+        if (singleMmap)
+            sqRingSize = cqRingSize = std::max(sqRingSize, cqRingSize);
+
+        sqRing = map(sqRingSize, IORING_OFF_SQ_RING);
+        cqRing = singleMmap ? sqRing : map(cqRingSize, IORING_OFF_CQ_RING);
+        sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+        sqes = static_cast<io_uring_sqe *>(map(sqesSize, IORING_OFF_SQES));
+
+        char *sq = static_cast<char *>(sqRing);
+        sqTail = reinterpret_cast<unsigned *>(sq + params.sq_off.tail);
+        sqMask = *reinterpret_cast<unsigned *>(sq + params.sq_off.ring_mask);
+        sqArray = reinterpret_cast<unsigned *>(sq + params.sq_off.array);
+        sqEntries = params.sq_entries;
+
+        char *cq = static_cast<char *>(cqRing);
+        cqHead = reinterpret_cast<unsigned *>(cq + params.cq_off.head);
+        cqTail = reinterpret_cast<unsigned *>(cq + params.cq_off.tail);
+        cqMask = *reinterpret_cast<unsigned *>(cq + params.cq_off.ring_mask);
+        cqes = reinterpret_cast<io_uring_cqe *>(cq + params.cq_off.cqes);
+
+        DEBUG << "io_uring set up with" << sqEntries << "entries";
+    }
+
+    UringPoller(const UringPoller &) = delete;
+    UringPoller &operator=(const UringPoller &) = delete;
+
+    ~UringPoller()
+    {
+        if (sqes)
+            munmap(sqes, sqesSize);
+        if (cqRing && cqRing != sqRing)
+            munmap(cqRing, cqRingSize);
+        if (sqRing)
+            munmap(sqRing, sqRingSize);
+        if (ringFileDescriptor != errorCode)
+            close(ringFileDescriptor);
+    }
+
+    void add(int fd, uint32_t events, uint64_t data) override
+    {
+        events &= ~EPOLLET; // multishot poll reports every wakeup anyway
+        if (static_cast<size_t>(fd) >= registrations.size())
+            registrations.resize(static_cast<size_t>(fd) + 1);
+        registrations[fd] = {data, events};
+        pollAdd(fd, events, data);
+    }
+
+    // updates the running poll request in place
+    void modify(int fd, uint32_t events, uint64_t data) override
+    {
+        events &= ~EPOLLET;
+        if (static_cast<size_t>(fd) < registrations.size() && registrations[fd].data == data)
+            registrations[fd].events = events;
+
+        io_uring_sqe &sqe = getSqe();
+        sqe.opcode = IORING_OP_POLL_REMOVE;
+        sqe.fd = -1;
+        sqe.addr = data;
+        sqe.poll32_events = events;
+        sqe.len = IORING_POLL_UPDATE_EVENTS | IORING_POLL_ADD_MULTI;
+        sqe.user_data = ignoredUserData;
+    }
+
+    // the poll request holds a reference to the file, so the socket
+    // is really closed only after the request is removed
+    void remove(int fd, uint64_t data) override
+    {
+        if (static_cast<size_t>(fd) < registrations.size() && registrations[fd].data == data)
+            registrations[fd] = {};
+        io_uring_sqe &sqe = getSqe();
+        sqe.opcode = IORING_OP_POLL_REMOVE;
+        sqe.fd = -1;
+        sqe.addr = data;
+        sqe.user_data = ignoredUserData;
+    }
+
+    size_t wait(epoll_event *events, size_t maxEvents) override
+    {
+        if (ready() == 0)
+            enter(1);
+        else if (pending)
+            enter(0);
+
+        size_t count = 0;
+        unsigned head = *cqHead;
+        unsigned tail = std::atomic_ref<unsigned>(*cqTail).load(std::memory_order_acquire);
+        for (; head != tail && count < maxEvents; head++)
+        {
+            const io_uring_cqe &cqe = cqes[head & cqMask];
+            if (cqe.user_data == ignoredUserData)
+                continue;
+
+            if (cqe.res < 0)
+            {
+                // -ECANCELED after remove
+                DEBUG << "poll request ended with" << -cqe.res << std::strerror(-cqe.res);
+                continue;
+            }
+
+            events[count].events = static_cast<uint32_t>(cqe.res);
+            events[count].data.u64 = cqe.user_data;
+            count++;
+
+            // multishot poll may be terminated by the kernel, it has to be armed again then
+            if (!(cqe.flags & IORING_CQE_F_MORE))
+            {
+                int fd = static_cast<int>(static_cast<uint32_t>(cqe.user_data));
+                if (static_cast<size_t>(fd) < registrations.size() && registrations[fd].data == cqe.user_data)
+                    pollAdd(fd, registrations[fd].events, cqe.user_data);
+            }
+        }
+        std::atomic_ref<unsigned>(*cqHead).store(head, std::memory_order_release);
+        return count;
+    }
+
+private:
+    struct Registration
+    {
+        uint64_t data = ignoredUserData;
+        uint32_t events = 0;
+    };
+
+    static constexpr uint64_t ignoredUserData = ~0ULL;
+
+    void *map(size_t size, off_t offset)
+    {
+        void *pointer = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFileDescriptor, offset);
+        if (pointer == MAP_FAILED)
+            error("mmap");
+        return pointer;
+    }
+
+    void pollAdd(int fd, uint32_t events, uint64_t data)
+    {
+        io_uring_sqe &sqe = getSqe();
+        sqe.opcode = IORING_OP_POLL_ADD;
+        sqe.fd = fd;
+        sqe.poll32_events = events;
+        sqe.len = IORING_POLL_ADD_MULTI;
+        sqe.user_data = data;
+    }
+
+    io_uring_sqe &getSqe()
+    {
+        if (pending == sqEntries)
+            enter(0);
+        unsigned index = (*sqTail + pending) & sqMask;
+        io_uring_sqe &sqe = sqes[index];
+        std::memset(&sqe, 0, sizeof(sqe));
+        sqArray[index] = index;
+        pending++;
+        return sqe;
+    }
+
+    unsigned ready() const
+    {
+        return std::atomic_ref<unsigned>(*cqTail).load(std::memory_order_acquire) - *cqHead;
+    }
+
+    // submits all queued requests and waits for minComplete completions
+    void enter(unsigned minComplete)
+    {
+        std::atomic_ref<unsigned>(*sqTail).store(*sqTail + pending, std::memory_order_release);
+        unsigned toSubmit = pending;
+        pending = 0;
+        unsigned flags = minComplete ? IORING_ENTER_GETEVENTS : 0;
+        while (true)
+        {
+            systemCalls++;
+            int code = static_cast<int>(syscall(__NR_io_uring_enter, ringFileDescriptor, toSubmit, minComplete, flags, nullptr, 0));
+            if (code != errorCode)
+                return;
+            // completion ring is full, the caller has to reap it first
+            if (errno == EBUSY)
+                return;
+            // the kernel takes only what is left between its head and our tail
+            if (errno != EINTR && errno != EAGAIN)
+                error("io_uring_enter");
+        }
+    }
+
+    int ringFileDescriptor = -1;
+
+    void *sqRing = nullptr;
+    void *cqRing = nullptr;
+    io_uring_sqe *sqes = nullptr;
+    size_t sqRingSize = 0;
+    size_t cqRingSize = 0;
+    size_t sqesSize = 0;
+
+    unsigned *sqTail;
+    unsigned *sqArray;
+    unsigned sqMask;
+    unsigned sqEntries;
+    unsigned pending = 0;
+
+    unsigned *cqHead;
+    unsigned *cqTail;
+    unsigned cqMask;
+    io_uring_cqe *cqes;
+
+    // indexed by descriptor
+    std::vector<Registration> registrations;
+};
+
+#endif /* HTTP_SERVER_HAS_IO_URING */
+
+inline std::unique_ptr<Poller> Poller::create(Backend backend)
+{
+    if (backend == Backend::io_uring)
+    {
+#ifdef HTTP_SERVER_HAS_IO_URING
+        return std::make_unique<UringPoller>();
+#else
+        throw std::runtime_error("io_uring backend is not available");
+#endif
+    }
+    return std::make_unique<EpollPoller>();
+}
+
+#endif /* POLLER_H */
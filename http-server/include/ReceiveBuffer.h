@@ -0,0 +1,149 @@
+#ifndef RECEIVEBUFFER_H
+#define RECEIVEBUFFER_H
+
+#include <algorithm>
+#include <cstring>
+#include <memory>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+// Bytes received on a connection and not consumed yet. recv writes straight into
+// the free space after them and the parser reads them in place; consuming only
+// moves the start, the unread bytes are moved to the front only when there is no
+// room left after them. The memory comes in blocks from a thread-local pool and
+// goes back to it whenever the buffer becomes empty, so idle connections hold none.
+class ReceiveBuffer
+{
+public:
+    static constexpr size_t blockSize = 16384;
+    static constexpr size_t maxPooledBlocks = 1024;
+
+    ReceiveBuffer() = default;
+    ReceiveBuffer(const ReceiveBuffer &) = delete;
+    ReceiveBuffer &operator=(const ReceiveBuffer &) = delete;
+
+    ReceiveBuffer(ReceiveBuffer &&rhs) noexcept
+        : data(std::exchange(rhs.data, nullptr)), capacity(std::exchange(rhs.capacity, 0)),
+          begin(std::exchange(rhs.begin, 0)), end(std::exchange(rhs.end, 0)) {}
+
+    ReceiveBuffer &operator=(ReceiveBuffer &&rhs) noexcept
+    {
+        if (this != &rhs)
+        {
+            release();
+            data = std::exchange(rhs.data, nullptr);
+            capacity = std::exchange(rhs.capacity, 0);
+            begin = std::exchange(rhs.begin, 0);
+            end = std::exchange(rhs.end, 0);
+        }
+        return *this;
+    }
+
+    ~ReceiveBuffer()
+    {
+        release();
+    }
+
+    // the unread bytes, valid until the next prepare
+    std::string_view view() const
+    {
+        return std::string_view(data + begin, end - begin);
+    }
+
+    size_t size() const
+    {
+        return end - begin;
+    }
+
+    bool empty() const
+    {
+        return begin == end;
+    }
+
+    // marks the first length unread bytes as read
+    void consume(size_t length)
+    {
+        begin += std::min(length, size());
+        if (begin == end)
+            release();
+    }
+
+    // returns the free space after the unread bytes, at least minimum bytes long
+    std::pair<char *, size_t> prepare(size_t minimum)
+    {
+        if (capacity - end < minimum)
+        {
+            size_t needed = size() + minimum;
+            if (needed <= capacity)
+            {
+                std::memmove(data, data + begin, size());
+            }
+            else
+            {
+                size_t newCapacity = std::max(needed, std::max(capacity * 2, blockSize));
+                char *newData = allocate(newCapacity);
+                if (data)
+                    std::memcpy(newData, data + begin, size());
+                deallocate(data, capacity);
+                data = newData;
+                capacity = newCapacity;
+            }
+            end -= begin;
+            begin = 0;
+        }
+        return {data + end, capacity - end};
+    }
+
+    // adds length bytes written to the space returned by prepare
+    void commit(size_t length)
+    {
+        end += length;
+    }
+
+    // gives the memory back, only allowed when there are no unread bytes
+    void release()
+    {
+        deallocate(data, capacity);
+        data = nullptr;
+        capacity = begin = end = 0;
+    }
+
+private:
+    // blocks of the standard size are pooled, larger ones (long headers or bodies) are not
+    static char *allocate(size_t size)
+    {
+        auto &pool = getPool();
+        if (size == blockSize && !pool.empty())
+        {
+            char *block = pool.back().release();
+            pool.pop_back();
+            return block;
+        }
+        return new char[size];
+    }
+
+    static void deallocate(char *block, size_t size)
+    {
+        if (!block)
+            return;
+        auto &pool = getPool();
+        if (size == blockSize && pool.size() < maxPooledBlocks)
+            pool.emplace_back(block);
+        else
+            delete[] block;
+    }
+
+    static std::vector<std::unique_ptr<char[]>> &getPool()
+    {
+        static thread_local std::vector<std::unique_ptr<char[]>> pool;
+        return pool;
+    }
+
+    char *data = nullptr;
+    size_t capacity = 0;
+    size_t begin = 0;
+    size_t end = 0;
+};
+
+#endif /* RECEIVEBUFFER_H */
@@ -16,6 +16,24 @@ public:
     using CallbackType = std::function<void(HttpRequest&, HttpResponse&)>;
     // using ChainCallbackType = std::function<bool(HttpRequest&, HttpResponse&);
 
+    // Passed right after the path marks a route whose callbacks are cheap and never block.
+    // They are run directly on the event loop thread instead of the worker pool.
+    struct Inline {};
+    static constexpr Inline runInline{};
+
+    struct PreparedCallback
+    {
+        CallbackType callback;
+        bool runInline;
+    };
+
+    template <typename... CallbackT>
+    RequestHandler(std::string pathTemplate, Inline, CallbackT&&... callbacks)
+        : RequestHandler(std::move(pathTemplate), std::forward<CallbackT>(callbacks)...)
+    {
+        inlined = true;
+    }
+
     template <typename... CallbackT>
     RequestHandler(std::string pathTemplate, CallbackT&&... callbacks) : processCallbacks({callbacks...})
     {
@@ -36,6 +54,7 @@ private:
 
     std::vector<std::string> pathParamsNames;
     std::regex path;
+    bool inlined = false;
 
     void replaceString(std::string &pathTemplate, const std::string &replacement, const std::string &opening, const std::string &closing)
     {
@@ -55,21 +74,22 @@ private:
     }
 
     friend class HttpServer;
-    std::optional<CallbackType> prepareCallback(HttpRequest &request) const
+    std::optional<PreparedCallback> prepareCallback(HttpRequest &request) const
     {
-        static std::smatch match;
-        if (!regex_match(request.getUriBase(), match, path))
+        std::string_view uri = request.getUriBase();
+        std::match_results<std::string_view::const_iterator> match;
+        if (!regex_match(uri.begin(), uri.end(), match, path))
             return {};
         
         for (size_t i = 0; i < pathParamsNames.size(); i++)
             request.pathParams[pathParamsNames[i]] = match.str(i + 1);
 
-        return {[this](HttpRequest &request, HttpResponse &response) {
+        return PreparedCallback{[this](HttpRequest &request, HttpResponse &response) {
             defaultChecks(request, response);
             for (auto &callback : processCallbacks)
                 if (!response.isReady())
                     callback(request, response);
-        }};
+        }, inlined};
     }
 };
 
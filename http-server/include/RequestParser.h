@@ -0,0 +1,200 @@
+#ifndef REQUESTPARSER_H
+#define REQUESTPARSER_H
+
+#include <algorithm>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "ByteScanner.h"
+#include "ReceiveBuffer.h"
+
+// Keeps what is known about the request being received between reads, so each
+// received byte is looked at once however the request is split into packets: the
+// header lines found so far, where the current line started and the state of the
+// chunked body decoder. One parser serves all the requests of a connection and
+// keeps the memory of its line list between them.
+class RequestParser
+{
+public:
+    static constexpr size_t npos = std::string_view::npos;
+
+    enum class Status
+    {
+        incomplete, complete, malformed, tooLarge
+    };
+
+    // a header line as offsets into the received bytes
+    struct Line
+    {
+        size_t begin;
+        size_t end;     // the CR of the CRLF
+        size_t colon;   // the first colon, npos if there is none
+    };
+
+    // Starts a header block at the start of the received bytes, either a request
+    // header, before which empty lines are skipped, or the trailer of a chunked body.
+    void startHeader(bool requestHeader)
+    {
+        lines.clear();
+        skipEmptyLines = requestHeader;
+        headerBegin = lineBegin = scanned = 0;
+        colon = npos;
+        headerEnd = npos;
+    }
+
+    // Looks at the received bytes not seen yet, the ones seen before must still be
+    // there. The header is complete once an empty line is found.
+    Status scanHeader(std::string_view received, size_t maxLength)
+    {
+        ByteScanner::forEach(received.substr(scanned), '\n', ':', [&](size_t index) {
+            size_t position = scanned + index;
+            if (received[position] == ':')
+            {
+                if (colon == npos)
+                    colon = position;
+                return true;
+            }
+            // a bare LF is part of the line
+            if (position == lineBegin || received[position - 1] != '\r')
+                return true;
+            if (position - 1 > lineBegin)
+            {
+                lines.push_back({lineBegin, position - 1, colon});
+                skipEmptyLines = false;
+            }
+            else if (skipEmptyLines)
+                headerBegin = position + 1;
+            else
+                headerEnd = position + 1;
+            lineBegin = position + 1;
+            colon = npos;
+            return headerEnd == npos;
+        });
+        if (headerEnd != npos)
+            return Status::complete;
+        scanned = received.size();
+        return received.size() > maxLength ? Status::malformed : Status::incomplete;
+    }
+
+    // the lines of the complete header, the request line first
+    const std::vector<Line> &getLines() const { return lines; }
+    // the header without the empty lines before it and with the empty line after it
+    size_t getHeaderBegin() const { return headerBegin; }
+    size_t getHeaderEnd() const { return headerEnd; }
+
+    void startChunkedBody()
+    {
+        chunkState = ChunkState::size;
+        chunkLength = 0;
+        hasDigits = false;
+    }
+
+    // Moves the data of the chunks in buffer to body. Complete once the size line of
+    // the last chunk has been consumed, the trailer is left in the buffer.
+    Status decodeChunks(ReceiveBuffer &buffer, std::string &body, size_t maxLength)
+    {
+        while (!buffer.empty())
+        {
+            std::string_view received = buffer.view();
+            if (chunkState == ChunkState::data)
+            {
+                size_t length = std::min(chunkLength, received.size());
+                body.append(received.substr(0, length));
+                buffer.consume(length);
+                chunkLength -= length;
+                if (chunkLength == 0)
+                    chunkState = ChunkState::dataCr;
+                continue;
+            }
+
+            // the size line and the CRLF after the data are looked at byte by byte
+            size_t i = 0;
+            Status status = Status::incomplete;
+            for (; i < received.size() && status == Status::incomplete && chunkState != ChunkState::data; i++)
+                status = decodeControl(received[i], body.size(), maxLength);
+            buffer.consume(i);
+            if (status != Status::incomplete)
+                return status;
+        }
+        return Status::incomplete;
+    }
+
+    // the value of a hex digit, -1 if it is not one
+    static int hexValue(char digit)
+    {
+        if (digit >= '0' && digit <= '9')
+            return digit - '0';
+        if (digit >= 'a' && digit <= 'f')
+            return digit - 'a' + 10;
+        if (digit >= 'A' && digit <= 'F')
+            return digit - 'A' + 10;
+        return -1;
+    }
+
+private:
+    enum class ChunkState
+    {
+        size, extension, sizeLf, data, dataCr, dataLf
+    };
+
+    Status decodeControl(char byte, size_t bodyLength, size_t maxLength)
+    {
+        switch (chunkState)
+        {
+        case ChunkState::size:
+            if (int digit = hexValue(byte); digit >= 0)
+            {
+                chunkLength = chunkLength * 16 + static_cast<size_t>(digit);
+                hasDigits = true;
+                if (bodyLength + chunkLength > maxLength)
+                    return Status::tooLarge;
+                return Status::incomplete;
+            }
+            if (!hasDigits)
+                return Status::malformed;
+            chunkState = ChunkState::extension;
+            [[fallthrough]];
+        case ChunkState::extension:
+            // chunk extensions are ignored, a bare LF does not end the size line
+            if (byte == '\n')
+                return Status::malformed;
+            if (byte == '\r')
+                chunkState = ChunkState::sizeLf;
+            return Status::incomplete;
+        case ChunkState::sizeLf:
+            if (byte != '\n')
+                return Status::malformed;
+            if (chunkLength == 0)
+                return Status::complete;
+            chunkState = ChunkState::data;
+            return Status::incomplete;
+        case ChunkState::dataCr:
+            chunkState = ChunkState::dataLf;
+            return byte == '\r' ? Status::incomplete : Status::malformed;
+        case ChunkState::dataLf:
+            if (byte != '\n')
+                return Status::malformed;
+            startChunkedBody();
+            return Status::incomplete;
+        case ChunkState::data:
+            break;
+        }
+        return Status::incomplete;
+    }
+
+    std::vector<Line> lines;
+    bool skipEmptyLines = true;
+    size_t headerBegin = 0;
+    size_t headerEnd = npos;
+    size_t lineBegin = 0;
+    size_t colon = npos;
+    // received bytes already looked at
+    size_t scanned = 0;
+
+    ChunkState chunkState = ChunkState::size;
+    size_t chunkLength = 0;
+    bool hasDigits = false;
+};
+
+#endif /* REQUESTPARSER_H */
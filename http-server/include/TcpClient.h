@@ -1,17 +1,30 @@
 #ifndef TcpClient_H
 #define TcpClient_H
 
+#include <chrono>
+#include <span>
+#include <string_view>
+#include <sys/sendfile.h>
+#include <sys/uio.h>
+
+#include "EpollManager.h"
 #include "Network.h"
+#include "ReceiveBuffer.h"
 
 class TcpClient : public Network
 {
 public:
+    // free space a receive asks the buffer for, less would mean tiny reads
+    static constexpr size_t minReceiveSpace = 4096;
+    static constexpr size_t maxSegmentsPerCall = 64;
+
     TcpClient() = default;
 
     TcpClient(const TcpClient &) = delete;
     TcpClient(TcpClient &&rhs)
     {
         socket = rhs.socket;
+        epollManager = rhs.epollManager;
         rhs.socket = invalidSocket;
     }
 
@@ -21,6 +34,7 @@ public:
         if (socket != invalidSocket)
             close();
         socket = rhs.socket;
+        epollManager = rhs.epollManager;
         rhs.socket = invalidSocket;
         return *this;
     }
@@ -56,60 +70,150 @@ public:
 
     Coroutine<void> send(const std::string &buff)
     {
-        size_t length = 0;
+        std::string_view segment = buff;
+        co_await send(std::span<const std::string_view>(&segment, 1));
+    }
+
+    // Sends the segments one after another without joining them, as many as fit
+    // in one sendmsg call at a time. The segments must stay alive until it is done.
+    Coroutine<void> send(std::span<const std::string_view> segments, bool more = false)
+    {
         size_t totalLength = 0;
-        DEBUG << "sending" << buff.size() << "bytes of data starting with" << buff.substr(0, std::min(buff.size(), 16UL)) << "... on socket" << socket;
-        while (totalLength != buff.size())
+        for (auto segment : segments)
+            totalLength += segment.size();
+        DEBUG << "sending" << totalLength << "bytes of data in" << segments.size() << "segments on socket" << socket;
+
+        // position of the first byte not sent yet
+        size_t index = 0;
+        size_t offset = 0;
+        iovec vectors[maxSegmentsPerCall];
+        while (true)
         {
-            do
+            while (index < segments.size() && offset == segments[index].size())
+            {
+                index++;
+                offset = 0;
+            }
+            if (index == segments.size())
+                break;
+
+            msghdr message{};
+            message.msg_iov = vectors;
+            for (size_t i = index; i < segments.size() && message.msg_iovlen < maxSegmentsPerCall; i++)
             {
-                code = length = ::send(socket, buff.c_str() + totalLength, buff.size() - totalLength, MSG_DONTWAIT | MSG_NOSIGNAL);
-                if (code != errorCode)
-                    totalLength += length;
-                DEBUG << "send on socket" << socket << "returned" << code << "errno is" << errno;
-                if (tryAgain(code))
-                    co_await std::suspend_always();
-                else
-                    break;
-            } while (true);
-
-            if (code == errorCode)
+                size_t skip = i == index ? offset : 0;
+                vectors[message.msg_iovlen].iov_base = const_cast<char *>(segments[i].data() + skip);
+                vectors[message.msg_iovlen].iov_len = segments[i].size() - skip;
+                message.msg_iovlen++;
+            }
+
+            // more data follows (a file), so the kernel may wait to fill a whole packet
+            ssize_t length = sendmsg(socket, &message, MSG_DONTWAIT | MSG_NOSIGNAL | (more ? MSG_MORE : 0));
+            code = static_cast<int>(length);
+            DEBUG << "sendmsg on socket" << socket << "returned" << length << "errno is" << errno;
+            if (tryAgain(code))
+            {
+                co_await epollManager->writable(socket);
+                continue;
+            }
+            if (length < 0)
                 throw ConnectionClosedException();
 
+            totalLength -= static_cast<size_t>(length);
             DEBUG << length << "bytes sent";
-            DEBUG << buff.size() - totalLength << "bytes left";
+            DEBUG << totalLength << "bytes left";
+            if (totalLength > 0)
+                restartTimeout();
+            for (size_t sent = static_cast<size_t>(length); sent > 0;)
+            {
+                size_t step = std::min(sent, segments[index].size() - offset);
+                offset += step;
+                sent -= step;
+                if (offset == segments[index].size())
+                {
+                    index++;
+                    offset = 0;
+                }
+            }
         }
         DEBUG << "all bytes sent on socket" << socket;
-        co_return;
     }
 
-    Coroutine<std::string> receive()
+    // sends length bytes of the file from offset without copying them to user space
+    Coroutine<void> sendFile(int fileDescriptor, off_t offset, size_t length)
     {
-        size_t length = 0;
-        std::string buff(8192, 0);
+        DEBUG << "sending" << length << "bytes of file" << fileDescriptor << "on socket" << socket;
+        while (length > 0)
+        {
+            ssize_t sent = sendfile(socket, fileDescriptor, &offset, length);
+            code = static_cast<int>(sent);
+            DEBUG << "sendfile on socket" << socket << "returned" << sent << "errno is" << errno;
+            if (tryAgain(code))
+            {
+                co_await epollManager->writable(socket);
+                continue;
+            }
+            // the file got shorter than the Content-Length already sent
+            if (sent <= 0)
+                throw ConnectionClosedException();
+            length -= static_cast<size_t>(sent);
+            if (length > 0)
+                restartTimeout();
+        }
+        DEBUG << "file sent on socket" << socket;
+    }
+
+    // receives straight into the free space of the buffer, returns the number of bytes received
+    Coroutine<size_t> receive(ReceiveBuffer &buffer)
+    {
+        ssize_t received = 0;
         DEBUG << "receiving on socket" << socket;
         do
         {
-            code = length = recv(socket, buff.data(), buff.size(), MSG_DONTWAIT);
-            DEBUG << "recv on socket" << socket << "returned" << code << "errno is" << errno;
+            auto [space, spaceLength] = buffer.prepare(minReceiveSpace);
+            received = recv(socket, space, spaceLength, MSG_DONTWAIT);
+            code = static_cast<int>(received);
+            DEBUG << "recv on socket" << socket << "returned" << received << "errno is" << errno;
             if (tryAgain(code))
-                co_await std::suspend_always();
+            {
+                // an idle connection does not need to keep the memory while it waits
+                if (buffer.empty())
+                    buffer.release();
+                co_await epollManager->readable(socket);
+            }
             else
                 break;
         } while (true);
 
-        if (code != errorCode)
-        {
-            DEBUG << "received" << length << "bytes of data starting with" << buff.substr(0, std::min(buff.size(), 16UL)) << "... on socket" << socket;
-            buff.resize(length);
-        }
-        else
+        if (received <= 0)
             throw ConnectionClosedException();
 
-        if (buff.empty())
-            throw ConnectionClosedException();
+        size_t length = static_cast<size_t>(received);
+        buffer.commit(length);
+        DEBUG << "received" << length << "bytes of data starting with" << buffer.view().substr(buffer.size() - length, 16) << "... on socket" << socket;
+        co_return length;
+    }
+
+    // The event loop closes the connection if the timeout passes before it is set
+    // again or cleared. Has no effect on clients not managed by an event loop.
+    void setTimeout(std::chrono::milliseconds timeout)
+    {
+        if (epollManager)
+            epollManager->setTimeout(socket, timeout);
+    }
 
-        co_return buff;
+    void clearTimeout()
+    {
+        setTimeout(std::chrono::milliseconds::zero());
+    }
+
+    // Starts the timeout set last again. Sends call it whenever a part of the data
+    // gets out, so a timeout set before a send limits the time without progress
+    // rather than the whole transfer.
+    void restartTimeout()
+    {
+        if (epollManager)
+            epollManager->restartTimeout(socket);
     }
 
     void close()
@@ -143,7 +247,8 @@ private:
         socket = invalidSocket;
     }
 
-    TcpClient(Socket clientSocket) { socket = clientSocket; }
+    TcpClient(Socket clientSocket, EpollManager *epollManager) : epollManager(epollManager) { socket = clientSocket; }
+    EpollManager *epollManager = nullptr;
     int code;
     friend class TcpServer;
 };
@@ -11,7 +11,8 @@ class TcpServer : public Network
 {
 public:
 
-    TcpServer() = default;
+    TcpServer(Poller::Backend backend = Poller::Backend::epoll)
+        : epollManager(EpollManager::defaultMaxEvents, backend) {}
     
     //TODO remake all constructors (not used atm, they dont handle callback and epollmanager)
     /*
@@ -32,14 +33,16 @@ public:
     }
     */
 
-    using ClientTaskCallbackType = std::function<Coroutine<void>(TcpClient&&, Notify)>;
+    using ClientTaskCallbackType = std::function<Coroutine<void>(TcpClient, Notify)>;
 
     void setClientTaskCallback(ClientTaskCallbackType&& callback)
     {
         clientTaskCallback = callback;
     }
 
-    void bind(unsigned short port)
+    // reusePort lets several servers (one per event loop) listen on the same port,
+    // the kernel then spreads incoming connections between them
+    void bind(unsigned short port, bool reusePort = false)
     {
 
         socket = ::socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
@@ -55,6 +58,11 @@ public:
 
         int temp = 1;
         setsockopt(socket, SOL_SOCKET, SO_REUSEADDR, (char*)&temp, sizeof(temp));
+        if (reusePort && setsockopt(socket, SOL_SOCKET, SO_REUSEPORT, (char*)&temp, sizeof(temp)) == errorCode)
+        {
+            close();
+            error("setsockopt");
+        }
 
         code = ::bind(socket, (const struct sockaddr *)&addr, sizeof(addr));
         if (code == errorCode)
@@ -81,10 +89,11 @@ public:
         Socket clientSocket;
         do
         {
-            clientSocket = ::accept(socket, nullptr, nullptr);
+            // the client sockets must not block the loop either, sendfile has no flag for it
+            clientSocket = ::accept4(socket, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
             DEBUG << "accept on socket" << socket << "returned" << clientSocket;
             if (tryAgain(clientSocket))
-                co_await std::suspend_always();
+                co_await epollManager.readable(socket);
             else
                 break;
         }
@@ -96,7 +105,7 @@ public:
             error("accept");
         }
 
-        co_return TcpClient(clientSocket);
+        co_return TcpClient(clientSocket, &epollManager);
     }
 
     void close()
@@ -111,6 +120,17 @@ public:
         epollManager.wait();
     }
 
+    // before waitForever, the loop owns the batch once it runs
+    void setMaxEvents(size_t maxEvents)
+    {
+        epollManager.setMaxEvents(maxEvents);
+    }
+
+    EpollManager::Stats getStats() const
+    {
+        return epollManager.getStats();
+    }
+
     [[noreturn]]
     void waitForever()
     {
@@ -134,16 +154,12 @@ private:
     Coroutine<void> acceptingTask()
     {
         DEBUG << "accepting task started";
-        co_await std::suspend_always();
         while (true)
         {
-            auto tcpClientCoroutine = co_await accept();
-            iterative_co_await(tcpClientCoroutine);
-            TcpClient tcpClient = tcpClientCoroutine.value();
-            Notify notify;
+            TcpClient tcpClient = co_await accept();
             Network::Socket clientSocket = tcpClient.getSocket();
-            Notify::FileDescriptor efd = notify.getFileDescriptor();
-            epollManager.addSocket(clientSocket, efd, clientTaskCallback(std::move(tcpClient), std::move(notify)));
+            Notify notify = epollManager.createNotify(clientSocket);
+            epollManager.addSocket(clientSocket, clientTaskCallback(std::move(tcpClient), std::move(notify)));
         }
     }
 
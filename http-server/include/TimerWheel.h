@@ -0,0 +1,154 @@
+#ifndef TIMERWHEEL_H
+#define TIMERWHEEL_H
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+
+// Hierarchical timing wheel: 4 levels of 64 slots, each level 64 times coarser
+// than the one below. Timers are intrusive list nodes, so scheduling, cancelling
+// and expiring a single timer is O(1); timers far in the future are moved down
+// a level (cascaded) when the wheel gets close to them.
+class TimerWheel
+{
+public:
+    class Timer
+    {
+    public:
+        Timer() = default;
+        Timer(const Timer &) = delete;
+        Timer &operator=(const Timer &) = delete;
+
+        ~Timer()
+        {
+            cancel();
+        }
+
+        bool isArmed() const
+        {
+            return wheel != nullptr;
+        }
+
+        void cancel()
+        {
+            if (wheel)
+            {
+                unlink();
+                wheel->armed--;
+                wheel = nullptr;
+            }
+        }
+
+        uint64_t data = 0;
+
+    private:
+        void unlink()
+        {
+            prev->next = next;
+            next->prev = prev;
+            prev = next = this;
+        }
+
+        Timer *prev = this;
+        Timer *next = this;
+        uint64_t expiry = 0;
+        TimerWheel *wheel = nullptr;
+
+        friend class TimerWheel;
+    };
+
+    static constexpr unsigned levelBits = 6;
+    static constexpr unsigned levels = 4;
+    static constexpr uint64_t slotMask = (1ULL << levelBits) - 1;
+    static constexpr uint64_t maxTicks = (1ULL << (levelBits * levels)) - 1;
+
+    TimerWheel() = default;
+    TimerWheel(const TimerWheel &) = delete;
+    TimerWheel &operator=(const TimerWheel &) = delete;
+
+    ~TimerWheel()
+    {
+        for (auto &level : slots)
+            for (auto &slot : level)
+                while (slot.next != &slot)
+                    slot.next->cancel();
+    }
+
+    uint64_t getCurrentTick() const
+    {
+        return current;
+    }
+
+    bool empty() const
+    {
+        return armed == 0;
+    }
+
+    // the timer expires at the given tick, but not earlier than on the next one
+    void scheduleAt(Timer &timer, uint64_t tick)
+    {
+        timer.cancel();
+        timer.expiry = std::clamp(tick, current + 1, current + maxTicks);
+        timer.wheel = this;
+        armed++;
+        insert(timer);
+    }
+
+    // moves the wheel to the given tick and calls expired(timer) for every timer
+    // that expires on the way, the timer is already cancelled then
+    template <class Callback>
+    void advance(uint64_t tick, Callback &&expired)
+    {
+        if (armed == 0)
+            current = std::max(current, tick);
+        while (current < tick)
+        {
+            current++;
+            cascade();
+            Timer &slot = slots[0][current & slotMask];
+            while (slot.next != &slot)
+            {
+                Timer *timer = slot.next;
+                timer->cancel();
+                expired(*timer);
+            }
+        }
+    }
+
+private:
+    void insert(Timer &timer)
+    {
+        uint64_t delta = timer.expiry - current;
+        unsigned level = 0;
+        while (level + 1 < levels && delta >> (levelBits * (level + 1)))
+            level++;
+
+        Timer &slot = slots[level][(timer.expiry >> (levelBits * level)) & slotMask];
+        timer.prev = slot.prev;
+        timer.next = &slot;
+        slot.prev->next = &timer;
+        slot.prev = &timer;
+    }
+
+    void cascade()
+    {
+        for (unsigned level = 1; level < levels; level++)
+        {
+            if (current & ((1ULL << (levelBits * level)) - 1))
+                return;
+            Timer &slot = slots[level][(current >> (levelBits * level)) & slotMask];
+            while (slot.next != &slot)
+            {
+                Timer *timer = slot.next;
+                timer->unlink();
+                insert(*timer);
+            }
+        }
+    }
+
+    std::array<std::array<Timer, 1ULL << levelBits>, levels> slots;
+    uint64_t current = 0;
+    size_t armed = 0;
+};
+
+#endif /* TIMERWHEEL_H */
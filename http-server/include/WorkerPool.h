@@ -0,0 +1,126 @@
+#ifndef WORKERPOOL_H
+#define WORKERPOOL_H
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "Debug.h"
+
+// Fixed number of threads running jobs from a bounded queue.
+// Jobs which do not fit into the queue are rejected instead of waiting.
+class WorkerPool
+{
+public:
+    using Job = std::function<void()>;
+
+    struct Stats
+    {
+        size_t threads = 0;
+        size_t queueDepth = 0;
+        size_t queued = 0;      // jobs waiting at the moment
+        size_t maxQueued = 0;   // the longest the queue has ever been
+        size_t submitted = 0;
+        size_t completed = 0;
+        size_t rejected = 0;
+    };
+
+    inline static const size_t defaultThreads = std::max(std::thread::hardware_concurrency(), 1u);
+    static constexpr size_t defaultQueueDepth = 1024;
+
+    WorkerPool(size_t threads = defaultThreads, size_t queueDepth = defaultQueueDepth)
+        : queueDepth(std::max<size_t>(queueDepth, 1))
+    {
+        threads = std::max<size_t>(threads, 1);
+        for (size_t i = 0; i < threads; i++)
+            workers.emplace_back([this] { work(); });
+        DEBUG << "worker pool started with" << threads << "threads";
+    }
+
+    WorkerPool(const WorkerPool &) = delete;
+    WorkerPool &operator=(const WorkerPool &) = delete;
+
+    ~WorkerPool()
+    {
+        {
+            std::lock_guard lock(mutex);
+            stopping = true;
+        }
+        condition.notify_all();
+        for (auto &worker : workers)
+            worker.join();
+    }
+
+    // returns false if the queue is full, the job is dropped then
+    bool submit(Job &&job)
+    {
+        {
+            std::lock_guard lock(mutex);
+            if (jobs.size() >= queueDepth)
+            {
+                rejected++;
+                DEBUG << "worker pool queue full, job rejected";
+                return false;
+            }
+            jobs.emplace_back(std::move(job));
+            submitted++;
+            maxQueued = std::max(maxQueued, jobs.size());
+        }
+        condition.notify_one();
+        return true;
+    }
+
+    Stats getStats() const
+    {
+        std::lock_guard lock(mutex);
+        Stats stats;
+        stats.threads = workers.size();
+        stats.queueDepth = queueDepth;
+        stats.queued = jobs.size();
+        stats.maxQueued = maxQueued;
+        stats.submitted = submitted;
+        stats.completed = completed.load(std::memory_order_relaxed);
+        stats.rejected = rejected;
+        return stats;
+    }
+
+private:
+    void work()
+    {
+        while (true)
+        {
+            Job job;
+            {
+                std::unique_lock lock(mutex);
+                condition.wait(lock, [this] { return stopping || !jobs.empty(); });
+                if (jobs.empty())
+                    return;
+                job = std::move(jobs.front());
+                jobs.pop_front();
+            }
+            job();
+            completed.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    const size_t queueDepth;
+
+    mutable std::mutex mutex;
+    std::condition_variable condition;
+    std::deque<Job> jobs;
+    bool stopping = false;
+
+    size_t maxQueued = 0;
+    size_t submitted = 0;
+    size_t rejected = 0;
+    std::atomic<size_t> completed = 0;
+
+    std::vector<std::thread> workers;
+};
+
+#endif /* WORKERPOOL_H */
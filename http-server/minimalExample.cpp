@@ -13,7 +13,8 @@ int main()
 {
     HttpServer server;
 
-    server.get("/hello", [](auto &request, auto &response) {
+    // cheap callbacks can be run directly on the event loop thread
+    server.get("/hello", RequestHandler::runInline, [](auto &request, auto &response) {
         response.setStatus(200).setBody("Hello");
     });
 
@@ -0,0 +1,108 @@
+#ifndef LOOPBACKCLIENT_H
+#define LOOPBACKCLIENT_H
+
+#include <chrono>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <vector>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+// Blocking keep-alive connections to a server of the same process, for the benchmarks.
+// Each round sends the request on every connection before reading the answers, so
+// the event loop sees several sockets per wakeup.
+class LoopbackClient
+{
+public:
+    LoopbackClient(std::string request) : request(std::move(request)) {}
+
+    LoopbackClient(const LoopbackClient &) = delete;
+    LoopbackClient &operator=(const LoopbackClient &) = delete;
+
+    ~LoopbackClient()
+    {
+        for (int fd : sockets)
+            ::close(fd);
+    }
+
+    // retries while the server is starting, returns false if it never accepts
+    bool connect(unsigned short port, size_t connections)
+    {
+        for (size_t i = 0; i < connections; i++)
+        {
+            int fd = connectTo(port);
+            if (fd == -1)
+                return false;
+            sockets.push_back(fd);
+        }
+        buffers.resize(sockets.size());
+        return true;
+    }
+
+    bool roundTrip()
+    {
+        for (int fd : sockets)
+            if (::send(fd, request.data(), request.size(), MSG_NOSIGNAL) != static_cast<ssize_t>(request.size()))
+                return false;
+        for (size_t i = 0; i < sockets.size(); i++)
+            if (!readResponse(sockets[i], buffers[i]))
+                return false;
+        return true;
+    }
+
+    size_t connections() const
+    {
+        return sockets.size();
+    }
+
+private:
+    static int connectTo(unsigned short port)
+    {
+        for (int attempt = 0; attempt < 100; attempt++)
+        {
+            int fd = ::socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+            sockaddr_in address{};
+            address.sin_family = AF_INET;
+            address.sin_port = htons(port);
+            address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+            if (::connect(fd, reinterpret_cast<sockaddr *>(&address), sizeof(address)) == 0)
+                return fd;
+            ::close(fd);
+            std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        }
+        return -1;
+    }
+
+    // reads one response with a Content-Length, returns false if the connection ended
+    static bool readResponse(int fd, std::string &buffer)
+    {
+        char chunk[4096];
+        while (true)
+        {
+            size_t headerEnd = buffer.find("\r\n\r\n");
+            if (headerEnd != std::string::npos)
+            {
+                size_t lengthAt = buffer.find("Content-Length: ");
+                size_t length = lengthAt < headerEnd ? std::strtoull(buffer.c_str() + lengthAt + 16, nullptr, 10) : 0;
+                if (buffer.size() >= headerEnd + 4 + length)
+                {
+                    buffer.erase(0, headerEnd + 4 + length);
+                    return true;
+                }
+            }
+            ssize_t received = ::recv(fd, chunk, sizeof(chunk), 0);
+            if (received <= 0)
+                return false;
+            buffer.append(chunk, static_cast<size_t>(received));
+        }
+    }
+
+    std::string request;
+    std::vector<int> sockets;
+    std::vector<std::string> buffers;
+};
+
+#endif /* LOOPBACKCLIENT_H */
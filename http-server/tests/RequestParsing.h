@@ -0,0 +1,24 @@
+#ifndef REQUESTPARSING_H
+#define REQUESTPARSING_H
+
+#include <string_view>
+
+#include "HttpRequest.h"
+
+// Builds a request from a whole header without a connection, the way fetchRequest
+// does once it received the empty line. A friend of HttpRequest, for the tests and
+// benchmarks only.
+struct RequestParsing
+{
+    // false if the parser does not find a complete header
+    static bool parse(HttpRequest &request, std::string_view header, RequestParser &parser)
+    {
+        parser.startHeader(true);
+        if (parser.scanHeader(header, HttpRequest::maxHeaderLength) != RequestParser::Status::complete)
+            return false;
+        request.parseHeader(header, parser);
+        return true;
+    }
+};
+
+#endif /* REQUESTPARSING_H */
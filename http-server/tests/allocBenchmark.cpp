@@ -0,0 +1,141 @@
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <string>
+#include <thread>
+
+#include "HttpServer.h"
+#include "LoopbackClient.h"
+
+// Counts the calls of the global operator new, replaced here. First for a chain of
+// coroutines awaiting each other the way a request does (the connection task awaits
+// fetchRequest, which awaits readHeader, which awaits receive), then for whole
+// requests answered by a server of the same process: an inline route and a JSON
+// route run on the worker pool. The allocations of the client thread are not
+// counted, the debug logging of the server is. Takes the number of rounds, 2000
+// by default, and the number of connections, 4.
+
+static std::atomic<size_t> allocations = 0;
+static thread_local bool uncounted = false;
+
+// the replacements below pair malloc and free, GCC only sees the free of a new
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+
+void *operator new(size_t size)
+{
+    if (!uncounted)
+        allocations.fetch_add(1, std::memory_order_relaxed);
+    if (void *pointer = std::malloc(size ? size : 1))
+        return pointer;
+    throw std::bad_alloc();
+}
+
+void operator delete(void *pointer) noexcept
+{
+    std::free(pointer);
+}
+
+void operator delete(void *pointer, size_t) noexcept
+{
+    std::free(pointer);
+}
+
+Coroutine<size_t> receive(size_t &received)
+{
+    co_return ++received;
+}
+
+Coroutine<std::string_view> readHeader(size_t &received)
+{
+    co_await receive(received);
+    co_await receive(received);
+    co_return "GET / HTTP/1.1";
+}
+
+Coroutine<size_t> fetchRequest(size_t &received)
+{
+    std::string_view header = co_await readHeader(received);
+    co_return header.size();
+}
+
+Coroutine<void> connection(size_t requests, size_t &received)
+{
+    for (size_t i = 0; i < requests; i++)
+        co_await fetchRequest(received);
+}
+
+// the frames of one chain are allocated once, then taken from the free lists
+static void benchmarkChain(size_t rounds)
+{
+    constexpr size_t requests = 4;
+    size_t received = 0;
+    auto run = [&] {
+        size_t before = allocations.load();
+        Coroutine<void> task = connection(requests, received);
+        task.resume();
+        if (!task.done())
+            std::abort();
+        return allocations.load() - before;
+    };
+    size_t cold = run();
+    size_t warm = 0;
+    for (size_t i = 0; i < rounds; i++)
+        warm += run();
+    std::printf("coroutine chain of %zu requests: %zu allocations on the first run, %.2f per request after it\n",
+        requests, cold, static_cast<double>(warm) / (rounds * requests));
+}
+
+static bool benchmarkRoute(HttpServer &server, unsigned short port, const char *path, size_t rounds, size_t connections)
+{
+    LoopbackClient client(std::string("GET ") + path + " HTTP/1.1\r\nHost: localhost\r\nConnection: keep-alive\r\n\r\n");
+    // connections, buffers and frames are set up before counting
+    if (!client.connect(port, connections) || !client.roundTrip())
+        return false;
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    auto statsBefore = server.getEventLoopStats();
+    size_t before = allocations.load();
+
+    for (size_t round = 0; round < rounds; round++)
+        if (!client.roundTrip())
+            return false;
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+
+    double requests = static_cast<double>(rounds * connections);
+    auto stats = server.getEventLoopStats();
+    std::printf("%-8s %.0f requests: %.2f allocations per request, %.2f frames from the free lists, %zu frames allocated\n",
+        path, requests, (allocations.load() - before) / requests,
+        (stats.frameHits - statsBefore.frameHits) / requests, stats.frameMisses - statsBefore.frameMisses);
+    return true;
+}
+
+int main(int argc, char **argv)
+{
+    size_t rounds = argc > 1 ? std::max<size_t>(std::strtoull(argv[1], nullptr, 10), 1) : 2000;
+    size_t connections = argc > 2 ? std::max<size_t>(std::strtoull(argv[2], nullptr, 10), 1) : 4;
+    // writing the debug output would dominate, building it is still counted
+    std::cout.rdbuf(nullptr);
+
+    benchmarkChain(rounds);
+
+    uncounted = true;
+    constexpr unsigned short port = 38480;
+    // listen never returns, the server is left running until the process exits
+    auto *server = new HttpServer;
+    server->get("/hello", RequestHandler::runInline, [](auto &request, auto &response) {
+        response.setStatus(200).setBody("hello");
+    });
+    server->get("/json", [](auto &request, auto &response) {
+        response.setStatus(200).setJsonBody(json{{"number", 7}, {"squared", 49}});
+    });
+    std::thread([server] { server->listen(port); }).detach();
+
+    bool passed = benchmarkRoute(*server, port, "/hello", rounds, connections)
+        && benchmarkRoute(*server, port, "/json", rounds, connections);
+    if (!passed)
+        std::fprintf(stderr, "requests failed on port %hu\n", port);
+    std::fflush(stdout);
+    // the event loop still runs, the process ends without destroying it
+    std::_Exit(passed ? 0 : 1);
+}
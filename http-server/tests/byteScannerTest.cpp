@@ -0,0 +1,178 @@
+#include <cstdio>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "ByteScanner.h"
+#include "RequestParser.h"
+
+// The vector kernels of ByteScanner must report the same bytes as the scalar loop,
+// above all around the edges of their 16, 32 and 64 byte blocks, and the parser
+// built on them must find the same lines however the header is split into reads.
+
+using Kernel = ByteScanner::Kernel;
+
+static int failures = 0;
+
+static void check(bool condition, const char *message, size_t size, size_t position)
+{
+    if (!condition)
+    {
+        std::fprintf(stderr, "FAILED: %s (size %zu, position %zu)\n", message, size, position);
+        failures++;
+    }
+}
+
+// the kernels this CPU can run, the selected one is the widest
+static std::vector<Kernel> kernels()
+{
+    std::vector<Kernel> available = {Kernel::scalar};
+    for (Kernel kernel : {Kernel::sse2, Kernel::avx2})
+        if (static_cast<int>(kernel) <= static_cast<int>(ByteScanner::kernel()))
+            available.push_back(kernel);
+    return available;
+}
+
+static std::vector<size_t> expected(std::string_view data, char first, char second, size_t limit = SIZE_MAX)
+{
+    std::vector<size_t> found;
+    for (size_t i = 0; i < data.size() && found.size() < limit; i++)
+        if (data[i] == first || data[i] == second)
+            found.push_back(i);
+    return found;
+}
+
+static std::vector<size_t> scan(std::string_view data, Kernel kernel, size_t limit = SIZE_MAX)
+{
+    std::vector<size_t> found;
+    ByteScanner::forEach(data, '\n', ':', [&](size_t index) {
+        found.push_back(index);
+        return found.size() < limit;
+    }, kernel);
+    return found;
+}
+
+static void compare(std::string_view data, size_t position, const char *message)
+{
+    auto want = expected(data, '\n', ':');
+    for (Kernel kernel : kernels())
+    {
+        check(scan(data, kernel) == want, message, data.size(), position);
+        // a visitor returning false stops the scan right there, also inside a block
+        for (size_t limit = 1; limit <= want.size(); limit++)
+            check(scan(data, kernel, limit) == expected(data, '\n', ':', limit), "stops where the visitor stops", data.size(), limit);
+    }
+}
+
+// one byte, or a CRLF, at every position of buffers around the block sizes
+static void testBlockEdges()
+{
+    for (size_t size = 0; size <= 200; size++)
+    {
+        std::string data(size, 'x');
+        compare(data, 0, "no matches");
+        for (size_t position = 0; position < size; position++)
+        {
+            for (char byte : {'\n', ':'})
+            {
+                data[position] = byte;
+                compare(data, position, "single byte");
+                data[position] = 'x';
+            }
+            if (position + 1 < size)
+            {
+                data[position] = '\r';
+                data[position + 1] = '\n';
+                compare(data, position, "CRLF");
+                data[position] = data[position + 1] = 'x';
+            }
+            // a CR as the last byte is not a match
+            data[position] = '\r';
+            compare(data, position, "CR");
+            data[position] = 'x';
+        }
+    }
+}
+
+// unaligned starts and bytes with the high bit set, which compare as negative chars
+static void testRandom()
+{
+    std::mt19937 random(7);
+    const char alphabet[] = {'\r', '\n', ':', 'a', '\x8a', '\xba', '\xff', ' '};
+    std::string buffer(400, 'x');
+    for (int round = 0; round < 20000; round++)
+    {
+        for (char &byte : buffer)
+            byte = alphabet[random() % sizeof(alphabet)];
+        size_t offset = random() % 64;
+        size_t size = random() % (buffer.size() - offset);
+        std::string_view data(buffer.data() + offset, size);
+        auto want = expected(data, '\n', ':');
+        for (Kernel kernel : kernels())
+            check(scan(data, kernel) == want, "random bytes", size, offset);
+    }
+}
+
+// the lines of a header, found naively: CRLF ends a line, the first empty line ends the header
+static std::vector<RequestParser::Line> expectedLines(std::string_view header)
+{
+    std::vector<RequestParser::Line> lines;
+    size_t begin = 0;
+    while (true)
+    {
+        size_t end = header.find("\r\n", begin);
+        if (end == begin)
+            return lines;
+        size_t colon = header.substr(begin, end - begin).find(':');
+        lines.push_back({begin, end, colon == std::string_view::npos ? RequestParser::npos : begin + colon});
+        begin = end + 2;
+    }
+}
+
+static bool sameLines(const std::vector<RequestParser::Line> &a, const std::vector<RequestParser::Line> &b)
+{
+    if (a.size() != b.size())
+        return false;
+    for (size_t i = 0; i < a.size(); i++)
+        if (a[i].begin != b[i].begin || a[i].end != b[i].end || a[i].colon != b[i].colon)
+            return false;
+    return true;
+}
+
+// The CRLFs of the header fall on every offset of the blocks as the path grows, and
+// the header is received in two reads split at every byte, so a read also ends with
+// the CR of a line whose LF comes with the next one.
+static void testParserSplits()
+{
+    RequestParser parser;
+    for (size_t pathLength = 1; pathLength <= 140; pathLength++)
+    {
+        std::string header = "GET /" + std::string(pathLength - 1, 'p') + " HTTP/1.1\r\n"
+            "Host: localhost:3000\r\nX-Empty:\r\nAccept: */*\r\n\r\n";
+        auto want = expectedLines(header);
+        for (size_t split = 1; split <= header.size(); split++)
+        {
+            parser.startHeader(true);
+            auto status = parser.scanHeader(std::string_view(header).substr(0, split), header.size());
+            if (split < header.size())
+            {
+                check(status == RequestParser::Status::incomplete, "incomplete before the empty line", header.size(), split);
+                status = parser.scanHeader(header, header.size());
+            }
+            check(status == RequestParser::Status::complete, "complete", header.size(), split);
+            check(parser.getHeaderEnd() == header.size(), "header end", header.size(), split);
+            check(sameLines(parser.getLines(), want), "lines", header.size(), split);
+        }
+    }
+}
+
+int main()
+{
+    testBlockEdges();
+    testRandom();
+    testParserSplits();
+    if (failures)
+        return 1;
+    std::printf("byte scanner tests passed with %zu kernels\n", kernels().size());
+    return 0;
+}
@@ -0,0 +1,162 @@
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "RequestParser.h"
+
+// The chunked body decoder keeps its state between reads, so each body of the table
+// is decoded as it arrives in two reads split at every byte, and one byte at a time,
+// and must always give the same body, trailer and status as when it comes at once.
+
+using Status = RequestParser::Status;
+
+static int failures = 0;
+
+static void check(bool condition, const char *message, const std::string &encoded, size_t split)
+{
+    if (!condition)
+    {
+        std::string printable;
+        for (char c : encoded)
+            printable += c == '\r' ? "\\r" : c == '\n' ? "\\n" : std::string(1, c);
+        std::fprintf(stderr, "FAILED: %s (%s, split at %zu)\n", message, printable.c_str(), split);
+        failures++;
+    }
+}
+
+struct Decoded
+{
+    Status status = Status::incomplete;
+    std::string body;
+    std::vector<std::string> trailer;   // the trailer lines, once the body is complete
+    Status trailerStatus = Status::incomplete;
+};
+
+static void append(ReceiveBuffer &buffer, std::string_view bytes)
+{
+    if (bytes.empty())
+        return;
+    auto [space, spaceLength] = buffer.prepare(bytes.size());
+    std::memcpy(space, bytes.data(), bytes.size());
+    buffer.commit(bytes.size());
+}
+
+// feeds the reads to the decoder and then to the trailer scan, the way fetchRequest does
+static Decoded decode(const std::vector<std::string_view> &reads, size_t maxLength)
+{
+    Decoded decoded;
+    RequestParser parser;
+    ReceiveBuffer buffer;
+    parser.startChunkedBody();
+    bool inTrailer = false;
+    for (std::string_view read : reads)
+    {
+        append(buffer, read);
+        if (!inTrailer)
+        {
+            decoded.status = parser.decodeChunks(buffer, decoded.body, maxLength);
+            if (decoded.status != Status::complete)
+            {
+                if (decoded.status != Status::incomplete)
+                    return decoded;
+                continue;
+            }
+            inTrailer = true;
+            parser.startHeader(false);
+        }
+        decoded.trailerStatus = parser.scanHeader(buffer.view(), 1000);
+        if (decoded.trailerStatus != Status::incomplete)
+            break;
+    }
+    if (decoded.trailerStatus == Status::complete)
+        for (auto &line : parser.getLines())
+            decoded.trailer.emplace_back(buffer.view().substr(line.begin, line.end - line.begin));
+    return decoded;
+}
+
+static void testTable()
+{
+    struct Case
+    {
+        std::string encoded;
+        Status status;
+        std::string body;
+        std::vector<std::string> trailer = {};
+        Status trailerStatus = Status::complete;
+        size_t maxLength = 1000;
+    };
+    const Case cases[] = {
+        {"0\r\n\r\n", Status::complete, ""},
+        {"5\r\nhello\r\n0\r\n\r\n", Status::complete, "hello"},
+        {"5\r\nhello\r\n6\r\n world\r\n0\r\n\r\n", Status::complete, "hello world"},
+        // hex sizes in either case, with leading zeros
+        {"A\r\n0123456789\r\nb\r\n0123456789a\r\n0\r\n\r\n", Status::complete, "01234567890123456789a"},
+        {"0005\r\nhello\r\n000\r\n\r\n", Status::complete, "hello"},
+        // extensions, and anything after the size, are ignored
+        {"5;name=value\r\nhello\r\n0;last\r\n\r\n", Status::complete, "hello"},
+        {"5 \r\nhello\r\n0\r\n\r\n", Status::complete, "hello"},
+        // the data may contain CRLFs and anything else
+        {"4\r\n\r\n0\r\r\n0\r\n\r\n", Status::complete, "\r\n0\r"},
+        // trailers
+        {"5\r\nhello\r\n0\r\nX-Checksum: abc\r\nExpires: never\r\n\r\n", Status::complete, "hello",
+            {"X-Checksum: abc", "Expires: never"}},
+        {"0\r\nX-Empty:\r\n\r\n", Status::complete, "", {"X-Empty:"}},
+        // the body is complete before its trailer is
+        {"5\r\nhello\r\n0\r\nX-Checksum: abc\r\n", Status::complete, "hello", {}, Status::incomplete},
+        {"5\r\nhello\r\n0\r\n", Status::complete, "hello", {}, Status::incomplete},
+        // incomplete
+        {"", Status::incomplete, ""},
+        {"5", Status::incomplete, ""},
+        {"5\r\nhel", Status::incomplete, "hel"},
+        {"5\r\nhello\r", Status::incomplete, "hello"},
+        {"5\r\nhello\r\n0", Status::incomplete, "hello"},
+        // bad sizes
+        {"\r\n", Status::malformed, ""},
+        {"x\r\n", Status::malformed, ""},
+        {"-5\r\nhello\r\n", Status::malformed, ""},
+        {" 5\r\nhello\r\n", Status::malformed, ""},
+        {";ext\r\n", Status::malformed, ""},
+        {"5\rhello\r\n", Status::malformed, ""},
+        {"5\nhello\r\n", Status::malformed, ""},
+        {"5;a\nhello\r\n", Status::malformed, ""},
+        // the data must be followed by a CRLF
+        {"5\r\nhello!\r\n0\r\n\r\n", Status::malformed, "hello"},
+        {"5\r\nhello\n0\r\n\r\n", Status::malformed, "hello"},
+        {"5\r\nhello\rX", Status::malformed, "hello"},
+        // too large, also before a huge size can overflow
+        {"a\r\n0123456789\r\n0\r\n\r\n", Status::tooLarge, "", {}, Status::complete, 9},
+        {"5\r\nhello\r\n5\r\nworld\r\n0\r\n\r\n", Status::tooLarge, "hello", {}, Status::complete, 9},
+        {"ffffffffffffffffffffffff\r\n", Status::tooLarge, ""},
+        {"5\r\nhello\r\n0\r\n\r\n", Status::complete, "hello", {}, Status::complete, 5},
+    };
+    for (const Case &test : cases)
+    {
+        auto same = [&](const Decoded &decoded, size_t split) {
+            check(decoded.status == test.status, "status", test.encoded, split);
+            check(decoded.body == test.body, "body", test.encoded, split);
+            if (test.status == Status::complete)
+            {
+                check(decoded.trailerStatus == test.trailerStatus, "trailer status", test.encoded, split);
+                check(decoded.trailer == test.trailer, "trailer", test.encoded, split);
+            }
+        };
+        std::string_view encoded = test.encoded;
+        for (size_t split = 0; split <= encoded.size(); split++)
+            same(decode({encoded.substr(0, split), encoded.substr(split)}, test.maxLength), split);
+
+        std::vector<std::string_view> bytes;
+        for (size_t i = 0; i < encoded.size(); i++)
+            bytes.push_back(encoded.substr(i, 1));
+        same(decode(bytes, test.maxLength), 1);
+    }
+}
+
+int main()
+{
+    testTable();
+    if (failures)
+        return 1;
+    std::printf("chunked body tests passed\n");
+    return 0;
+}
@@ -0,0 +1,99 @@
+#include <cctype>
+#include <cstdio>
+#include <string>
+
+#include "HttpHeaders.h"
+
+// HeaderNames::find compares eight bytes at a time against a mask of the letters,
+// so every known name must be found in any case, and a single wrong byte anywhere
+// in it, one differing only in the case bit included, must make it unknown.
+
+static int failures = 0;
+
+static void check(bool condition, const char *message, const std::string &name)
+{
+    if (!condition)
+    {
+        std::fprintf(stderr, "FAILED: %s (%s)\n", message, name.c_str());
+        failures++;
+    }
+}
+
+static bool isLetter(char c)
+{
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z');
+}
+
+static std::string transform(std::string_view name, int (*convert)(int))
+{
+    std::string converted(name);
+    for (char &c : converted)
+        c = static_cast<char>(convert(static_cast<unsigned char>(c)));
+    return converted;
+}
+
+// the name as sent, lowercase, uppercase and with every other letter flipped
+static void testKnownNames()
+{
+    check(HeaderNames::count == 43, "count of known names", std::to_string(HeaderNames::count));
+    for (size_t i = 0; i < HeaderNames::count; i++)
+    {
+        auto header = static_cast<HeaderName>(i);
+        std::string_view name = HeaderNames::name(header);
+        std::string alternating(name);
+        for (size_t j = 0; j < alternating.size(); j += 2)
+            alternating[j] = static_cast<char>(alternating[j] ^ (isLetter(alternating[j]) ? 0x20 : 0));
+        for (const std::string &spelling : {std::string(name), transform(name, tolower), transform(name, toupper), alternating})
+            check(HeaderNames::find(spelling) == header, "known name", spelling);
+    }
+}
+
+// every byte of every name replaced by every other byte, except the same letter in the other case
+static void testNearMisses()
+{
+    for (size_t i = 0; i < HeaderNames::count; i++)
+    {
+        std::string name(HeaderNames::name(static_cast<HeaderName>(i)));
+        for (size_t position = 0; position < name.size(); position++)
+        {
+            char original = name[position];
+            for (int byte = 0; byte < 256; byte++)
+            {
+                char replacement = static_cast<char>(byte);
+                if (replacement == original || (isLetter(original) && replacement == (original ^ 0x20)))
+                    continue;
+                name[position] = replacement;
+                if (HeaderNames::find(name) != HeaderName::unknown)
+                    check(false, "one byte off is unknown", name);
+            }
+            name[position] = original;
+        }
+    }
+}
+
+static void testUnknownNames()
+{
+    const std::string cases[] = {
+        "", "A", "X", "Acceptt", "Accep", "Accept ", " Accept", "Accept:", "Content_Length",
+        "ContentLength", "Content-Lengt", "Content-Length2", "X-Forwarded-Fo", "X-Forwarded-For-",
+        "Set-Cookie2", "Cookies", "Hosts", "Date\r", "Rangee", "Etag-", "Connection\n",
+        "X-Request-Id", "Sec-Fetch-Mode", "Upgrade-Insecure-Requests", "Access-Control-Allow-Credentials",
+        "Access-Control-Max-Age", "Transfer-Encoding-Extra", std::string(32, 'a'), std::string(200, 'x'),
+        // the dash of Content-Type with bit 5 cleared, letters of Host with bit 6 or bits 5 and 6 cleared
+        "Content\x0dType", "Hos4", "Hos\x14", "H\x0fst",
+    };
+    for (const std::string &name : cases)
+        check(HeaderNames::find(name) == HeaderName::unknown, "unknown name", name);
+    check(HeaderNames::find(std::string("Host\0", 5)) == HeaderName::unknown, "unknown name", "Host\\0");
+}
+
+int main()
+{
+    testKnownNames();
+    testNearMisses();
+    testUnknownNames();
+    if (failures)
+        return 1;
+    std::printf("header name tests passed\n");
+    return 0;
+}
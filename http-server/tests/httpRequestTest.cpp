@@ -0,0 +1,283 @@
+#include <cstdio>
+#include <limits>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "HttpRequest.h"
+#include "RequestParsing.h"
+
+// What HttpRequest makes of the header fields it parses when asked: each case is a
+// field value sent by a client and what the request must answer for it.
+
+using Ranges = std::vector<HttpRequest::ByteRange>;
+
+static int failures = 0;
+
+static void check(bool condition, const char *message, const std::string &input)
+{
+    if (!condition)
+    {
+        std::fprintf(stderr, "FAILED: %s (%s)\n", message, input.c_str());
+        failures++;
+    }
+}
+
+// a GET with the one field, empty for none
+static HttpRequest makeRequest(const std::string &target, const std::string &field)
+{
+    static RequestParser parser;
+    HttpRequest request;
+    std::string header = "GET " + target + " HTTP/1.1\r\nHost: localhost\r\n" + (field.empty() ? "" : field + "\r\n") + "\r\n";
+    if (!RequestParsing::parse(request, header, parser) || request.isMalformed())
+        check(false, "header parsed", header);
+    return request;
+}
+
+static bool sameRanges(const Ranges &a, const Ranges &b)
+{
+    if (a.size() != b.size())
+        return false;
+    for (size_t i = 0; i < a.size(); i++)
+        if (a[i].first != b[i].first || a[i].last != b[i].last)
+            return false;
+    return true;
+}
+
+// count ranges of five bytes ten bytes apart, and what they select
+static std::string manyRanges(size_t count)
+{
+    std::string ranges = "bytes=";
+    for (size_t i = 0; i < count; i++)
+        ranges += (i ? "," : "") + std::to_string(i * 10) + '-' + std::to_string(i * 10 + 4);
+    return ranges;
+}
+
+static Ranges manySelected(size_t count)
+{
+    Ranges ranges;
+    for (size_t i = 0; i < count; i++)
+        ranges.push_back({i * 10, i * 10 + 4});
+    return ranges;
+}
+
+static void testRanges()
+{
+    struct Case
+    {
+        std::string range;
+        size_t length;
+        std::optional<Ranges> expected;    // nullopt sends the whole representation, empty is a 416
+    };
+    const Case cases[] = {
+        {"", 1000, std::nullopt},
+        {"bytes=0-499", 1000, Ranges{{0, 499}}},
+        {"bytes=0-0", 1000, Ranges{{0, 0}}},
+        // open-ended
+        {"bytes=500-", 1000, Ranges{{500, 999}}},
+        {"bytes=999-", 1000, Ranges{{999, 999}}},
+        // suffix
+        {"bytes=-200", 1000, Ranges{{800, 999}}},
+        {"bytes=-1000", 1000, Ranges{{0, 999}}},
+        {"bytes=-5000", 1000, Ranges{{0, 999}}},
+        // the last byte is cut to the length
+        {"bytes=990-5000", 1000, Ranges{{990, 999}}},
+        {"bytes=0-18446744073709551615", 1000, Ranges{{0, 999}}},
+        // several, with spaces and empty items, and overlapping ones kept as sent
+        {"bytes=0-9, 20-29 ,,-5", 1000, Ranges{{0, 9}, {20, 29}, {995, 999}}},
+        {"bytes=0-499,400-999", 1000, Ranges{{0, 499}, {400, 999}}},
+        {"bytes=100-199,0-", 1000, Ranges{{100, 199}, {0, 999}}},
+        // unsatisfiable ones are left out, if none is left the answer is a 416
+        {"bytes=0-9,1000-", 1000, Ranges{{0, 9}}},
+        {"bytes=1000-", 1000, Ranges{}},
+        {"bytes=1000-2000", 1000, Ranges{}},
+        {"bytes=-0", 1000, Ranges{}},
+        {"bytes=0-", 0, Ranges{}},
+        {"bytes=-5", 0, Ranges{}},
+        // invalid, the Range header is ignored
+        {"bytes=", 1000, std::nullopt},
+        {"bytes=,", 1000, std::nullopt},
+        {"bytes=5-4", 1000, std::nullopt},
+        {"bytes=abc", 1000, std::nullopt},
+        {"bytes=1-x", 1000, std::nullopt},
+        {"bytes=-", 1000, std::nullopt},
+        {"bytes=+1-2", 1000, std::nullopt},
+        {"bytes=0-9,5-4", 1000, std::nullopt},
+        {"bytes=18446744073709551616-", 1000, std::nullopt},
+        {"items=0-9", 1000, std::nullopt},
+        {"Bytes=0-9", 1000, std::nullopt},
+        // at most maxRanges ranges
+        {manyRanges(HttpRequest::maxRanges), 1000, manySelected(HttpRequest::maxRanges)},
+        {manyRanges(HttpRequest::maxRanges + 1), 1000, std::nullopt},
+    };
+    for (const Case &test : cases)
+    {
+        HttpRequest request = makeRequest("/", test.range.empty() ? "" : "Range: " + test.range);
+        auto ranges = request.getRanges(test.length);
+        check(ranges.has_value() == test.expected.has_value(), "whole representation or ranges", test.range);
+        if (ranges && test.expected)
+            check(sameRanges(*ranges, *test.expected), "ranges", test.range);
+    }
+}
+
+// the value the request reports for name through has and get, nullopt if it has none
+template <typename Has, typename Get>
+static std::optional<std::string> lookUp(Has has, Get get, const std::string &name)
+{
+    if (!has(name))
+    {
+        try {
+            get(name);
+        } catch (const std::out_of_range &) {
+            return std::nullopt;
+        }
+        return "get does not throw for a missing name";
+    }
+    return std::string(get(name));
+}
+
+static void testCookies()
+{
+    struct Case
+    {
+        std::string cookie;     // the Cookie header, empty for none
+        std::string name;
+        std::optional<std::string> expected;
+    };
+    const Case cases[] = {
+        {"", "a", std::nullopt},
+        {"a=1", "a", "1"},
+        {"a=1; b=2", "b", "2"},
+        {"a=1;b=2", "b", "2"},
+        {"a=1;;; b=2;", "b", "2"},
+        {"a = 1 ; b=2", "a", "1"},
+        {"a=", "a", ""},
+        {"a=\"quoted value\"", "a", "quoted value"},
+        {"a=\"", "a", "\""},
+        {"a=x=y", "a", "x=y"},
+        // values are not percent-decoded
+        {"a=%41+", "a", "%41+"},
+        // the first one counts
+        {"a=1; a=2", "a", "1"},
+        // names are case-sensitive
+        {"A=1", "a", std::nullopt},
+        {"ab=1", "a", std::nullopt},
+        // pairs without a name or an equals sign are skipped
+        {"=1; b=2", "", std::nullopt},
+        {"=1; b=2", "b", "2"},
+        {"alone; b=2", "alone", std::nullopt},
+        {"alone; b=2", "b", "2"},
+    };
+    for (const Case &test : cases)
+    {
+        HttpRequest request = makeRequest("/", test.cookie.empty() ? "" : "Cookie: " + test.cookie);
+        auto value = lookUp([&](auto &name) { return request.hasCookie(name); },
+            [&](auto &name) { return request.getCookie(name); }, test.name);
+        check(value == test.expected, "cookie", test.cookie + " " + test.name);
+    }
+}
+
+static void testQueryParams()
+{
+    struct Case
+    {
+        std::string target;
+        std::string name;
+        std::optional<std::string> expected;
+    };
+    const Case cases[] = {
+        {"/path", "a", std::nullopt},
+        {"/path?", "a", std::nullopt},
+        {"/path?a=1", "a", "1"},
+        {"/path?a=1&b=2", "b", "2"},
+        {"/path?&&a=1&&b=2&", "b", "2"},
+        {"/path?a=1#b=2", "b", std::nullopt},
+        {"/path?a=1#b=2", "a", "1"},
+        // a name alone, or with an empty value
+        {"/path?flag&b=2", "flag", ""},
+        {"/path?a=", "a", ""},
+        {"/path?a=b=c", "a", "b=c"},
+        // escapes and plus signs are decoded in names and values
+        {"/path?name=John+Smith", "name", "John Smith"},
+        {"/path?q=%41%62c", "q", "Abc"},
+        {"/path?q=%e2%82%AC", "q", "\xe2\x82\xac"},
+        {"/path?x=%26&y=%3D", "x", "&"},
+        {"/path?x=%26&y=%3D", "y", "="},
+        {"/path?%61=1", "a", "1"},
+        {"/path?a+b=1", "a b", "1"},
+        // invalid escapes are kept as they are
+        {"/path?q=%4", "q", "%4"},
+        {"/path?q=%zz1", "q", "%zz1"},
+        {"/path?q=100%", "q", "100%"},
+        {"/path?q=%%41", "q", "%A"},
+        // the first one counts, names are case-sensitive
+        {"/path?a=1&a=2", "a", "1"},
+        {"/path?A=1", "a", std::nullopt},
+        {"/path?ab=1", "a", std::nullopt},
+    };
+    for (const Case &test : cases)
+    {
+        HttpRequest request = makeRequest(test.target, "");
+        auto value = lookUp([&](auto &name) { return request.hasQueryParam(name); },
+            [&](auto &name) { return request.getQueryParam(name); }, test.name);
+        check(value == test.expected, "query parameter", test.target + " " + test.name);
+    }
+}
+
+static void testQueryInt()
+{
+    constexpr auto max = std::numeric_limits<long long>::max();
+    constexpr auto min = std::numeric_limits<long long>::min();
+    struct Case
+    {
+        std::string target;
+        std::optional<long long> expected;
+    };
+    const Case cases[] = {
+        {"/?n=42", 42},
+        {"/?n=-7", -7},
+        {"/?n=0", 0},
+        {"/?n=007", 7},
+        {"/?m=1&n=2&n=3", 2},
+        {"/?n=%34%32", 42},
+        {"/?n=9223372036854775807", max},
+        {"/?n=-9223372036854775808", min},
+        // missing or empty
+        {"/", std::nullopt},
+        {"/?m=1", std::nullopt},
+        {"/?n", std::nullopt},
+        {"/?n=", std::nullopt},
+        // not a whole decimal integer
+        {"/?n=12a", std::nullopt},
+        {"/?n=1.5", std::nullopt},
+        {"/?n=0x10", std::nullopt},
+        {"/?n=+7", std::nullopt},
+        {"/?n=%2B7", std::nullopt},
+        {"/?n=-", std::nullopt},
+        // bad escapes stay in the value
+        {"/?n=%3", std::nullopt},
+        {"/?n=4%zz", std::nullopt},
+        // overflow
+        {"/?n=9223372036854775808", std::nullopt},
+        {"/?n=-9223372036854775809", std::nullopt},
+        {"/?n=99999999999999999999999", std::nullopt},
+    };
+    for (const Case &test : cases)
+    {
+        HttpRequest request = makeRequest(test.target, "");
+        check(request.getQueryInt("n") == test.expected, "query integer", test.target);
+    }
+}
+
+int main()
+{
+    testRanges();
+    testCookies();
+    testQueryParams();
+    testQueryInt();
+    if (failures)
+        return 1;
+    std::printf("http request tests passed\n");
+    return 0;
+}
@@ -0,0 +1,164 @@
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <dlfcn.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "HttpServer.h"
+#include "LoopbackClient.h"
+
+// Counts the system calls the server makes per request with each readiness backend.
+// The sockets calls of the server threads are counted by wrapping their libc functions
+// here, the poller calls (epoll_ctl, epoll_wait, io_uring_enter) by the pollers
+// themselves, while a LoopbackClient sends requests on keep-alive connections.
+// Takes the number of rounds, 2000 by default, and the number of connections, 20.
+
+static std::atomic<size_t> socketCalls = 0;
+// the calls of the client thread are not counted
+static thread_local bool uncounted = false;
+
+template <typename Function>
+static Function next(const char *name)
+{
+    return reinterpret_cast<Function>(dlsym(RTLD_NEXT, name));
+}
+
+static void count()
+{
+    if (!uncounted)
+        socketCalls.fetch_add(1, std::memory_order_relaxed);
+}
+
+extern "C" {
+
+ssize_t recv(int fd, void *buffer, size_t length, int flags)
+{
+    static auto real = next<ssize_t (*)(int, void *, size_t, int)>("recv");
+    count();
+    return real(fd, buffer, length, flags);
+}
+
+ssize_t send(int fd, const void *buffer, size_t length, int flags)
+{
+    static auto real = next<ssize_t (*)(int, const void *, size_t, int)>("send");
+    count();
+    return real(fd, buffer, length, flags);
+}
+
+ssize_t sendmsg(int fd, const msghdr *message, int flags)
+{
+    static auto real = next<ssize_t (*)(int, const msghdr *, int)>("sendmsg");
+    count();
+    return real(fd, message, flags);
+}
+
+int accept4(int fd, sockaddr *address, socklen_t *length, int flags)
+{
+    static auto real = next<int (*)(int, sockaddr *, socklen_t *, int)>("accept4");
+    count();
+    return real(fd, address, length, flags);
+}
+
+ssize_t read(int fd, void *buffer, size_t length)
+{
+    static auto real = next<ssize_t (*)(int, void *, size_t)>("read");
+    count();
+    return real(fd, buffer, length);
+}
+
+ssize_t write(int fd, const void *buffer, size_t length)
+{
+    static auto real = next<ssize_t (*)(int, const void *, size_t)>("write");
+    count();
+    return real(fd, buffer, length);
+}
+
+}
+
+struct Result
+{
+    size_t requests = 0;
+    size_t pollerCalls = 0;
+    size_t socketCalls = 0;
+    double seconds = 0;
+};
+
+static bool run(HttpServer &server, unsigned short port, size_t rounds, size_t connections, Result &result)
+{
+    uncounted = true;
+    LoopbackClient client("GET /hello HTTP/1.1\r\nHost: localhost\r\nConnection: keep-alive\r\n\r\n");
+    // the connections are accepted and their buffers allocated before counting
+    if (!client.connect(port, connections) || !client.roundTrip())
+        return false;
+    // the loop publishes its counters after it handled the wakeup the client saw the end of
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    size_t pollerBefore = server.getEventLoopStats().systemCalls;
+    size_t socketBefore = socketCalls.load();
+
+    auto start = std::chrono::steady_clock::now();
+    for (size_t round = 0; round < rounds; round++)
+        if (!client.roundTrip())
+            return false;
+    result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+
+    result.requests = rounds * connections;
+    result.pollerCalls = server.getEventLoopStats().systemCalls - pollerBefore;
+    result.socketCalls = socketCalls.load() - socketBefore;
+    return true;
+}
+
+static bool available(Poller::Backend backend)
+{
+    try {
+        Poller::create(backend);
+        return true;
+    } catch (const std::exception &) {
+        return false;
+    }
+}
+
+int main(int argc, char **argv)
+{
+    size_t rounds = argc > 1 ? std::max<size_t>(std::strtoull(argv[1], nullptr, 10), 1) : 2000;
+    size_t connections = argc > 2 ? std::max<size_t>(std::strtoull(argv[2], nullptr, 10), 1) : 20;
+    // the debug output of the server would cost more than what is measured
+    std::cout.rdbuf(nullptr);
+
+    int failures = 0;
+    unsigned short port = 38470;
+    for (auto [backend, name] : {std::pair{Poller::Backend::epoll, "epoll"}, std::pair{Poller::Backend::io_uring, "io_uring"}})
+    {
+        port++;
+        if (!available(backend))
+        {
+            std::printf("%-8s not available\n", name);
+            continue;
+        }
+        // listen never returns, the servers are left running until the process exits
+        auto *server = new HttpServer;
+        server->setBackend(backend);
+        server->get("/hello", RequestHandler::runInline, [](auto &request, auto &response) {
+            response.setStatus(200).setBody("hello");
+        });
+        std::thread([server, port] { server->listen(port); }).detach();
+
+        Result result;
+        if (!run(*server, port, rounds, connections, result))
+        {
+            std::fprintf(stderr, "%s: requests failed on port %hu\n", name, port);
+            failures++;
+            continue;
+        }
+        double requests = static_cast<double>(result.requests);
+        std::printf("%-8s %zu requests, %.2f poller + %.2f socket = %.2f syscalls per request, %.0f requests/s\n",
+            name, result.requests, result.pollerCalls / requests, result.socketCalls / requests,
+            (result.pollerCalls + result.socketCalls) / requests, requests / result.seconds);
+    }
+    std::fflush(stdout);
+    // the event loops still run, the process ends without destroying them
+    std::_Exit(failures ? 1 : 0);
+}
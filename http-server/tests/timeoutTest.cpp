@@ -0,0 +1,164 @@
+#include <array>
+#include <chrono>
+#include <cstdio>
+#include <fcntl.h>
+#include <thread>
+#include <utility>
+#include <vector>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "EpollManager.h"
+
+// Idle connections have to be reaped even when other connections keep setting
+// their timeouts between the ticks of the wheel.
+
+using namespace std::chrono_literals;
+
+static constexpr auto idleTimeout = 300ms;
+
+struct ClosedFlag
+{
+    bool &closed;
+    ~ClosedFlag() { closed = true; }
+};
+
+Coroutine<void> idleTask(EpollManager &manager, int socket, bool &closed)
+{
+    ClosedFlag flag{closed};
+    manager.setTimeout(socket, idleTimeout);
+    while (true)
+        co_await manager.readable(socket);
+}
+
+// sets its timeout again whenever something arrives
+Coroutine<void> busyTask(EpollManager &manager, int socket, bool &closed)
+{
+    ClosedFlag flag{closed};
+    while (true)
+    {
+        manager.setTimeout(socket, idleTimeout);
+        co_await manager.readable(socket);
+        char buffer[64];
+        while (recv(socket, buffer, sizeof(buffer), MSG_DONTWAIT) > 0);
+    }
+}
+
+// both ends are closed with the pair, declared before the manager so that they
+// outlive the tasks using them
+struct Pair
+{
+    Pair()
+    {
+        int sockets[2];
+        if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, sockets) != 0)
+            error("socketpair");
+        local = sockets[0];
+        peer = sockets[1];
+    }
+
+    Pair(Pair &&rhs) : local(std::exchange(rhs.local, -1)), peer(std::exchange(rhs.peer, -1)) {}
+    Pair &operator=(Pair &&) = delete;
+
+    ~Pair()
+    {
+        if (local != -1)
+            ::close(local);
+        if (peer != -1)
+            ::close(peer);
+    }
+
+    int local;
+    int peer;
+};
+
+static int failures = 0;
+
+static void check(bool condition, const char *message)
+{
+    if (!condition)
+    {
+        std::fprintf(stderr, "FAILED: %s\n", message);
+        failures++;
+    }
+}
+
+// runs the loop for the given time, the peer of the busy connection sends a byte every step
+static void run(EpollManager &manager, int busyPeer, std::chrono::milliseconds duration)
+{
+    auto end = std::chrono::steady_clock::now() + duration;
+    while (std::chrono::steady_clock::now() < end)
+    {
+        if (send(busyPeer, "x", 1, MSG_DONTWAIT) != 1)
+            error("send");
+        manager.wait();
+        std::this_thread::sleep_for(13ms);
+    }
+}
+
+// a timer due while the loop was busy elsewhere is reaped on the next tick,
+// not skipped by a timeout set in between
+static void testTimerDueBeforeAnotherIsSet()
+{
+    Pair idle;
+    Pair other;
+    EpollManager manager;
+    bool idleClosed = false;
+    bool otherClosed = false;
+    manager.addSocket(idle.local, idleTask(manager, idle.local, idleClosed));
+    std::this_thread::sleep_for(idleTimeout + 150ms);
+    manager.addSocket(other.local, busyTask(manager, other.local, otherClosed));
+
+    run(manager, other.peer, 200ms);
+    check(idleClosed, "idle connection due before another timeout was set is reaped");
+    check(!otherClosed, "busy connection is kept");
+}
+
+static void testIdleAmongBusy()
+{
+    constexpr size_t idleCount = 40;
+    Pair busy;
+    std::vector<Pair> idle;
+    idle.reserve(idleCount);
+    EpollManager manager;
+    bool busyClosed = false;
+    manager.addSocket(busy.local, busyTask(manager, busy.local, busyClosed));
+
+    std::array<bool, idleCount> idleClosed{};
+    for (size_t i = 0; i < idleCount; i++)
+    {
+        idle.emplace_back();
+        manager.addSocket(idle.back().local, idleTask(manager, idle.back().local, idleClosed[i]));
+        run(manager, busy.peer, 13ms);
+    }
+    run(manager, busy.peer, idleTimeout + 2 * EpollManager::timerTick + 100ms);
+
+    size_t open = 0;
+    for (bool closed : idleClosed)
+        open += !closed;
+    if (open)
+        std::fprintf(stderr, "%zu of %zu idle connections still open\n", open, idleCount);
+    check(open == 0, "idle connections opened while another sets its timeout are reaped");
+    check(!busyClosed, "busy connection is kept");
+    check(manager.getStats().reaped == idleCount, "reaped count matches");
+}
+
+static size_t openDescriptors()
+{
+    size_t count = 0;
+    for (int fd = 0; fd < 1024; fd++)
+        count += fcntl(fd, F_GETFD) != -1;
+    return count;
+}
+
+int main()
+{
+    size_t descriptors = openDescriptors();
+    testTimerDueBeforeAnotherIsSet();
+    testIdleAmongBusy();
+    check(openDescriptors() == descriptors, "every descriptor of the tests is closed");
+    if (failures)
+        return 1;
+    std::printf("timeout tests passed\n");
+    return 0;
+}